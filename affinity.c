@@ -0,0 +1,299 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#if defined(__linux__)
+# include <sched.h>
+# include <unistd.h>
+# include <sys/socket.h>
+# include <sys/syscall.h>
+# include <linux/filter.h>
+# include <linux/mempolicy.h>
+typedef cpu_set_t cpu_mask_t;
+#elif defined(__FreeBSD__)
+# include <sys/param.h>
+# include <sys/cpuset.h>
+typedef cpuset_t cpu_mask_t;
+#endif
+
+#include <gawen/safe-call.h>
+#include <gawen/common.h>
+#include <gawen/log.h>
+
+#include "affinity.h"
+
+#if defined(__linux__) || defined(__FreeBSD__)
+static void get_affinity(cpu_mask_t *mask)
+{
+  int n;
+
+  CPU_ZERO(mask);
+#ifdef __linux__
+  n = sched_getaffinity(0, sizeof(cpu_mask_t), mask);
+#else
+  n = cpuset_getaffinity(CPU_LEVEL_WHICH, CPU_WHICH_PID, -1, sizeof(cpu_mask_t), mask);
+#endif
+  if(n < 0)
+    sysstd_abort("cannot get CPU affinity");
+}
+
+static void set_affinity(cpu_mask_t *mask)
+{
+  int n;
+
+#ifdef __linux__
+  n = sched_setaffinity(0, sizeof(cpu_mask_t), mask);
+#else
+  n = cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_PID, -1, sizeof(cpu_mask_t), mask);
+#endif
+  if(n < 0)
+    sysstd_abort("cannot set CPU affinity");
+}
+
+/* Find the n-th CPU of the mask (modulo the number of CPUs). */
+static int nth_cpu(const cpu_mask_t *mask, unsigned int n)
+{
+  int cpu, count;
+
+  count = CPU_COUNT(mask);
+  if(!count)
+    sysstd_abortx("no CPU available");
+  n %= count;
+
+  for(cpu = 0 ; cpu < CPU_SETSIZE ; cpu++) {
+    if(!CPU_ISSET(cpu, mask))
+      continue;
+    if(!n--)
+      break;
+  }
+
+  return cpu;
+}
+
+int pin_cpu(unsigned int n)
+{
+  cpu_mask_t mask;
+  int cpu;
+
+  get_affinity(&mask);
+  cpu = nth_cpu(&mask, n);
+
+  CPU_ZERO(&mask);
+  CPU_SET(cpu, &mask);
+  set_affinity(&mask);
+
+  return cpu;
+}
+#else
+int pin_cpu(unsigned int n)
+{
+  UNUSED(n);
+  sysstd_abortx("CPU pinning not supported on this platform");
+  return -1;
+}
+#endif
+
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+void steer_cpu(int sd, unsigned int workers)
+{
+  struct sock_filter *filter;
+  struct sock_fprog prog;
+  cpu_mask_t mask;
+  unsigned int w, i = 0;
+
+  /* The workers are pinned as in pin_cpu(). The program maps the CPU
+     of each worker to its index, anything out of the group falls back
+     to the hash of the flow. */
+  filter = xmalloc((2 * workers + 2) * sizeof(struct sock_filter));
+  filter[i++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+
+  get_affinity(&mask);
+  for(w = 0 ; w < workers ; w++) {
+    filter[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, nth_cpu(&mask, w), 0, 1);
+    filter[i++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, w);
+  }
+  filter[i++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+
+  prog = (struct sock_fprog){ .len = i, .filter = filter };
+  if(setsockopt(sd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+    sysstd_abort("cannot attach steering program");
+
+  free(filter);
+}
+
+void incoming_cpu(int sd, int cpu)
+{
+  if(setsockopt(sd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0)
+    sysstd_abort("cannot set incoming CPU");
+}
+#else
+void steer_cpu(int sd, unsigned int workers)
+{
+  UNUSED(sd);
+  UNUSED(workers);
+  sysstd_abortx("CPU steering not supported on this platform");
+}
+
+void incoming_cpu(int sd, int cpu)
+{
+  UNUSED(sd);
+  UNUSED(cpu);
+  sysstd_abortx("CPU steering not supported on this platform");
+}
+#endif
+
+#ifdef __linux__
+#define NODE_PATH "/sys/devices/system/node"
+#define NET_PATH  "/sys/class/net"
+
+/* Parse a list of CPUs or nodes from sysfs (e.g. 0-3,8-11).
+   Return -1 when the file cannot be read. */
+static int read_list(const char *path, cpu_mask_t *mask)
+{
+  FILE *fp = fopen(path, "r");
+  unsigned int first, last;
+  int c;
+
+  CPU_ZERO(mask);
+  if(!fp)
+    return -1;
+
+  while(fscanf(fp, "%u", &first) == 1) {
+    last = first;
+    c = fgetc(fp);
+    if(c == '-') {
+      if(fscanf(fp, "%u", &last) != 1)
+        break;
+      c = fgetc(fp);
+    }
+
+    for(; first <= last && first < CPU_SETSIZE ; first++)
+      CPU_SET(first, mask);
+
+    if(c != ',')
+      break;
+  }
+
+  fclose(fp);
+  return 0;
+}
+
+static void online_nodes(cpu_mask_t *nodes)
+{
+  /* no NUMA support in the kernel means a single node */
+  if(read_list(NODE_PATH "/online", nodes) < 0 || !CPU_COUNT(nodes)) {
+    CPU_ZERO(nodes);
+    CPU_SET(0, nodes);
+  }
+}
+
+unsigned int node_count(void)
+{
+  cpu_mask_t nodes;
+
+  online_nodes(&nodes);
+  return CPU_COUNT(&nodes);
+}
+
+int nth_node(unsigned int n)
+{
+  cpu_mask_t nodes;
+
+  online_nodes(&nodes);
+  return nth_cpu(&nodes, n);
+}
+
+int interface_node(const char *ifname)
+{
+  char path[256];
+  FILE *fp;
+  int node = -1;
+
+  /* virtual interfaces have no device */
+  snprintf(path, sizeof(path), NET_PATH "/%s/device/numa_node", ifname);
+  fp = fopen(path, "r");
+  if(!fp)
+    return -1;
+
+  if(fscanf(fp, "%d", &node) != 1)
+    node = -1;
+
+  fclose(fp);
+  return node;
+}
+
+void bind_node(int node)
+{
+  unsigned long nodemask[1024 / (8 * sizeof(unsigned long))] = { 0 };
+  unsigned int bits = 8 * sizeof(nodemask);
+  cpu_mask_t allowed, cpus;
+  char path[256];
+
+  if(node < 0 || (unsigned int)node >= bits)
+    sysstd_abortx("invalid NUMA node %d", node);
+
+  snprintf(path, sizeof(path), NODE_PATH "/node%d/cpulist", node);
+  if(read_list(path, &cpus) < 0)
+    sysstd_abort("cannot read CPUs of NUMA node %d", node);
+
+  /* only the CPUs we are allowed to run on */
+  get_affinity(&allowed);
+  CPU_AND(&cpus, &cpus, &allowed);
+  if(!CPU_COUNT(&cpus))
+    sysstd_abortx("no CPU available on NUMA node %d", node);
+  set_affinity(&cpus);
+
+  /* Preferred rather than bound so that the allocations
+     fall back to the other nodes when this one is full.
+     The kernel reads one bit less than specified. */
+  nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+  if(syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodemask, bits + 1) < 0)
+    sysstd_abort("cannot set memory policy");
+}
+#else
+unsigned int node_count(void)
+{
+  return 1;
+}
+
+int nth_node(unsigned int n)
+{
+  UNUSED(n);
+  return 0;
+}
+
+int interface_node(const char *ifname)
+{
+  UNUSED(ifname);
+  return -1;
+}
+
+void bind_node(int node)
+{
+  UNUSED(node);
+  sysstd_abortx("NUMA placement not supported on this platform");
+}
+#endif /* __linux__ */
@@ -0,0 +1,58 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _AFFINITY_H_
+#define _AFFINITY_H_
+
+/* Pin the calling process to the n-th CPU among those it is
+   allowed to run on (modulo the number of such CPUs).
+   Return the CPU number. */
+int pin_cpu(unsigned int n);
+
+/* Steer the datagrams and connections of a group of sockets bound
+   to the same address (SO_REUSEPORT) to the worker pinned to the CPU
+   that received them. The sockets of the group are numbered by worker
+   in the order they were bound. Packets received on a CPU that no
+   worker is pinned to are spread by the kernel as usual. */
+void steer_cpu(int sd, unsigned int workers);
+
+/* Tell the kernel that the socket is served on this CPU. */
+void incoming_cpu(int sd, int cpu);
+
+/* Number of NUMA nodes online. */
+unsigned int node_count(void);
+
+/* The n-th NUMA node online (modulo the number of nodes). */
+int nth_node(unsigned int n);
+
+/* NUMA node of the device of a network interface,
+   -1 when unknown or the system has a single node. */
+int interface_node(const char *ifname);
+
+/* Restrict the calling process to the CPUs of a NUMA node and
+   allocate its memory on this node when possible. This is inherited
+   by the children so that the memory they touch first is local. */
+void bind_node(int node);
+
+#endif /* _AFFINITY_H_ */
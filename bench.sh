@@ -0,0 +1,57 @@
+#!/bin/sh
+# Run the standard benchmark scenarios against echod on loopback.
+# Results are written as CSV on the standard output.
+#
+# BENCH_ENGINES  engines to compare (default: fork prefork, and event on Linux)
+# BENCH_PORT     port used by the daemon (default: 17007)
+# BENCH_DURATION duration of each scenario in seconds (default: 5)
+
+port=${BENCH_PORT:-17007}
+duration=${BENCH_DURATION:-5}
+
+engines=${BENCH_ENGINES:-"fork prefork"}
+if [ -z "$BENCH_ENGINES" ] && [ "$(uname -s)" = Linux ]
+then
+  engines="$engines event"
+fi
+
+# protocol, payload size, concurrency, rate
+scenarios="
+u 64    1  10000
+u 1400  8  50000
+t 64    8  1000
+k 64    16 20000
+k 16384 4  5000
+"
+
+# Kill a process and its descendants. The parent goes first
+# so that the prefork engine does not respawn its workers.
+kill_tree() {
+  children=$(pgrep -P "$1")
+  kill "$1" 2> /dev/null
+  for child in $children
+  do
+    kill_tree "$child"
+  done
+}
+
+header=-H
+for engine in $engines
+do
+  ./echod -4 -s -e "$engine" -c 64 -T 1000 "127.0.0.1/$port" > /dev/null 2>&1 &
+  pid=$!
+  sleep 1
+
+  echo "$scenarios" | while read proto size concurrency rate
+  do
+    [ -z "$proto" ] && continue
+    ./echobench $header -$proto -s "$size" -c "$concurrency" -r "$rate" -d "$duration" \
+                -l "$engine" "127.0.0.1/$port"
+    header=
+  done
+  header=
+
+  kill_tree "$pid"
+  wait "$pid" 2> /dev/null
+  sleep 1 # let the orphans release the port
+done
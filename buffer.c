@@ -0,0 +1,80 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <syslog.h>
+
+#include <gawen/log.h>
+
+#include "buffer.h"
+
+/* Huge page size used to round the mapping. Using a larger
+   size than the actual huge page size is harmless. */
+#define HUGE_PAGE_SIZE (2 << 20)
+
+static void * alloc_huge(size_t len)
+{
+  void *p = MAP_FAILED;
+
+#if defined(MAP_HUGETLB)
+  /* reserved huge pages (Linux) */
+  p = mmap(NULL, (len + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1),
+           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+# ifdef MADV_HUGEPAGE
+  /* fallback to transparent huge pages */
+  if(p == MAP_FAILED) {
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p != MAP_FAILED && madvise(p, len, MADV_HUGEPAGE) < 0) {
+      munmap(p, len);
+      p = MAP_FAILED;
+    }
+  }
+# endif
+#elif defined(MAP_ALIGNED_SUPER)
+  /* superpages (FreeBSD) */
+  p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_ALIGNED_SUPER, -1, 0);
+#endif
+
+  return p == MAP_FAILED ? NULL : p;
+}
+
+void * alloc_buffers(size_t size, unsigned int count, int huge_pages)
+{
+  size_t len = size * count;
+  void *p;
+
+  if(huge_pages) {
+    p = alloc_huge(len);
+    if(p)
+      return p;
+    sysstd_warn(LOG_WARNING, "cannot allocate huge pages, using normal pages");
+  }
+
+  p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    sysstd_abort("cannot allocate buffers");
+
+  return p;
+}
@@ -0,0 +1,146 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include <gawen/common.h>
+#include <gawen/log.h>
+
+#include "busy.h"
+
+uint64_t busy_budget;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void busy_poll_socket(int sd, unsigned int budget)
+{
+  int optval;
+
+  /* Poll the device queue directly from the receive calls.
+     Raising the value above the system default is privileged,
+     the spin in user space still works without it. */
+#ifdef SO_BUSY_POLL
+  optval = budget;
+  if(setsockopt(sd, SOL_SOCKET, SO_BUSY_POLL, &optval, sizeof(optval)) < 0)
+    sysstd_warn(LOG_WARNING, "cannot enable busy polling on socket");
+#endif
+
+#ifdef SO_PREFER_BUSY_POLL
+  optval = 1;
+  if(setsockopt(sd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &optval, sizeof(optval)) < 0)
+    sysstd_warn(LOG_WARNING, "cannot prefer busy polling on socket");
+#endif
+
+#if !defined(SO_BUSY_POLL) && !defined(SO_PREFER_BUSY_POLL)
+  UNUSED(sd);
+  UNUSED(budget);
+  UNUSED(optval);
+#endif
+}
+
+void busy_poll_init(unsigned int budget)
+{
+  busy_budget = (uint64_t)budget * 1000;
+}
+
+uint64_t busy_deadline(void)
+{
+  return now_ns() + busy_budget;
+}
+
+int busy_spinning(uint64_t deadline)
+{
+  return now_ns() < deadline;
+}
+
+ssize_t busy_recv(int fd, void *buf, size_t len, int flags)
+{
+  if(busy_budget) {
+    uint64_t deadline = busy_deadline();
+
+    do {
+      ssize_t n = recv(fd, buf, len, flags | MSG_DONTWAIT);
+      if(n >= 0 || errno != EAGAIN)
+        return n;
+    } while(busy_spinning(deadline));
+  }
+
+  return recv(fd, buf, len, flags);
+}
+
+ssize_t busy_recvmsg(int fd, struct msghdr *msg, int flags)
+{
+  if(busy_budget) {
+    uint64_t deadline = busy_deadline();
+
+    do {
+      ssize_t n = recvmsg(fd, msg, flags | MSG_DONTWAIT);
+      if(n >= 0 || errno != EAGAIN)
+        return n;
+    } while(busy_spinning(deadline));
+  }
+
+  return recvmsg(fd, msg, flags);
+}
+
+#ifdef MSG_WAITFORONE
+int busy_recvmmsg(int fd, struct mmsghdr *msgs, unsigned int len, int flags)
+{
+  if(busy_budget) {
+    uint64_t deadline = busy_deadline();
+
+    do {
+      int n = recvmmsg(fd, msgs, len, flags | MSG_DONTWAIT, NULL);
+      if(n >= 0 || errno != EAGAIN)
+        return n;
+    } while(busy_spinning(deadline));
+  }
+
+  return recvmmsg(fd, msgs, len, flags, NULL);
+}
+#endif /* MSG_WAITFORONE */
+
+void busy_wait(int fd)
+{
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  uint64_t deadline;
+
+  if(!busy_budget)
+    return;
+
+  deadline = busy_deadline();
+  while(!poll(&pfd, 1, 0) && busy_spinning(deadline));
+}
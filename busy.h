@@ -0,0 +1,60 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _BUSY_H_
+#define _BUSY_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdint.h>
+
+/* Busy polling spins with non-blocking calls for a budget before
+   falling back to the blocking call. This avoids the wakeup latency
+   of the scheduler at the cost of a core spinning when idle. */
+
+/* Spin budget of the current process in ns (0 when disabled). */
+extern uint64_t busy_budget;
+
+/* Enable busy polling in the socket layer for a socket.
+   The budget is in us, we share it with the kernel. */
+void busy_poll_socket(int sd, unsigned int budget);
+
+/* Enable busy polling in the current process, budget in us. */
+void busy_poll_init(unsigned int budget);
+
+/* End of the spin that starts now and whether it is still running. */
+uint64_t busy_deadline(void);
+int busy_spinning(uint64_t deadline);
+
+/* Receive calls that spin before blocking. */
+ssize_t busy_recv(int fd, void *buf, size_t len, int flags);
+ssize_t busy_recvmsg(int fd, struct msghdr *msg, int flags);
+#ifdef MSG_WAITFORONE
+int busy_recvmmsg(int fd, struct mmsghdr *msgs, unsigned int len, int flags);
+#endif
+
+/* Spin until the descriptor is readable (for accept). */
+void busy_wait(int fd);
+
+#endif /* _BUSY_H_ */
@@ -0,0 +1,525 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <err.h>
+
+#include <gawen/common.h>
+
+#include "stats.h"
+
+/* Load generator for echod. Requests are sent on a fixed schedule
+   whatever the answers (open loop) and the latency is measured from
+   the time each request was supposed to be sent. A slow server thus
+   cannot hide its tail latency by delaying the requests themselves. */
+
+#define DEFAULT_SIZE     64
+#define DEFAULT_RATE     1000
+#define DEFAULT_DURATION 5
+#define DRAIN_TIME       1000000000ULL /* ns to wait for late answers */
+#define STREAM_BACKLOG   64            /* requests pending on a TCP stream */
+
+enum mode {
+  MODE_UDP,    /* one datagram per request */
+  MODE_TCP,    /* one connection per request */
+  MODE_STREAM  /* persistent connections */
+};
+
+static const char *mode_names[] = { "udp", "tcp", "stream" };
+
+/* Each request starts with this header and the answer carries it back. */
+struct probe {
+  uint64_t intended; /* ns */
+  uint64_t seq;
+};
+
+struct flow {
+  int fd;
+  int busy;       /* tcp: request in progress */
+
+  unsigned char *out; /* bytes not sent yet */
+  size_t out_len;
+  size_t out_off;
+
+  unsigned char *in;  /* answer received so far */
+  size_t in_len;
+};
+
+static enum mode        mode = MODE_UDP;
+static unsigned int     concurrency = 1;
+static size_t           size  = DEFAULT_SIZE;
+static unsigned int     rate  = DEFAULT_RATE;
+static unsigned int     duration = DEFAULT_DURATION;
+static struct addrinfo *server;
+
+static struct flow *flows;
+static int         *free_flows; /* tcp: stack of idle flows */
+static unsigned int nb_free;
+
+static uint64_t hist[HIST_BUCKETS];
+static uint64_t requests; /* requests sent or queued */
+static uint64_t answers;
+static uint64_t errors;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-utkH] [-c concurrency] [-s size] [-r rate] [-d seconds]\n"
+                  "       [-l label] [host[/port]]\n", name);
+  exit(EXIT_FAILURE);
+}
+
+static void fill_request(unsigned char *request, uint64_t intended, uint64_t seq)
+{
+  struct probe p = { .intended = intended, .seq = seq };
+
+  memcpy(request, &p, sizeof(p));
+  memset(request + sizeof(p), 'x', size - sizeof(p));
+}
+
+static void record_answer(const unsigned char *answer)
+{
+  struct probe p;
+  uint64_t now = now_ns();
+
+  memcpy(&p, answer, sizeof(p));
+  if(p.intended > now || p.seq >= requests) {
+    errors++; /* garbled answer */
+    return;
+  }
+
+  hist[hist_bucket(now - p.intended)]++;
+  answers++;
+}
+
+static int open_socket(int nonblock)
+{
+  int fd, optval = 1;
+
+  fd = socket(server->ai_family, server->ai_socktype, server->ai_protocol);
+  if(fd < 0)
+    err(EXIT_FAILURE, "cannot create socket");
+
+  if(server->ai_socktype == SOCK_STREAM)
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+
+  if(nonblock && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+    err(EXIT_FAILURE, "cannot switch socket to non-blocking mode");
+
+  if(connect(fd, server->ai_addr, server->ai_addrlen) < 0 && errno != EINPROGRESS) {
+    if(!nonblock)
+      err(EXIT_FAILURE, "cannot connect");
+    close(fd);
+    return -1;
+  }
+
+  if(!nonblock && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+    err(EXIT_FAILURE, "cannot switch socket to non-blocking mode");
+
+  return fd;
+}
+
+/* Release a flow after its request completed or failed. */
+static void close_flow(struct flow *f)
+{
+  close(f->fd);
+  f->fd      = -1;
+  f->out_len = 0;
+  f->out_off = 0;
+  f->in_len  = 0;
+
+  if(mode == MODE_TCP) {
+    f->busy = 0;
+    free_flows[nb_free++] = f - flows;
+  }
+}
+
+static void flow_error(struct flow *f)
+{
+  errors++;
+  close_flow(f);
+}
+
+static void flow_send(struct flow *f)
+{
+  while(f->out_off < f->out_len) {
+    ssize_t n = send(f->fd, f->out + f->out_off, f->out_len - f->out_off, MSG_NOSIGNAL);
+    if(n < 0) {
+      switch(errno) {
+      case EINTR:
+        continue;
+      case EAGAIN:
+      case ENOTCONN: /* connection in progress */
+        return;
+      default:
+        flow_error(f);
+        return;
+      }
+    }
+    f->out_off += n;
+  }
+
+  f->out_len = 0;
+  f->out_off = 0;
+}
+
+static void flow_recv(struct flow *f)
+{
+  while(f->fd >= 0) {
+    ssize_t n = recv(f->fd, f->in + f->in_len, size - f->in_len, 0);
+    if(n < 0) {
+      switch(errno) {
+      case EINTR:
+        continue;
+      case EAGAIN:
+        return;
+      default:
+        if(mode == MODE_UDP) /* ICMP error, the socket is still usable */
+          errors++;
+        else
+          flow_error(f);
+        return;
+      }
+    }
+
+    if(mode == MODE_UDP) {
+      if((size_t)n == size)
+        record_answer(f->in);
+      else
+        errors++;
+      continue;
+    }
+
+    if(n == 0) { /* connection closed before the answer */
+      flow_error(f);
+      return;
+    }
+
+    f->in_len += n;
+    if(f->in_len < size)
+      continue;
+
+    record_answer(f->in);
+    f->in_len = 0;
+
+    if(mode == MODE_TCP)
+      close_flow(f);
+  }
+}
+
+/* Start the request seq. Return 0 when there is no flow available. */
+static int start_request(uint64_t intended, uint64_t seq)
+{
+  struct flow *f;
+
+  switch(mode) {
+  case MODE_UDP:
+    f = &flows[seq % concurrency];
+    fill_request(f->out, intended, seq);
+    requests++;
+
+    /* datagrams are lost when the socket buffer is full */
+    if(send(f->fd, f->out, size, 0) < 0)
+      errors++;
+    break;
+  case MODE_STREAM:
+    f = &flows[seq % concurrency];
+    requests++;
+
+    if(f->fd < 0 || f->out_len + size > STREAM_BACKLOG * size) {
+      errors++;
+      break;
+    }
+
+    fill_request(f->out + f->out_len, intended, seq);
+    f->out_len += size;
+    flow_send(f);
+    break;
+  case MODE_TCP:
+    if(!nb_free)
+      return 0;
+
+    f = &flows[free_flows[--nb_free]];
+    requests++;
+
+    f->fd = open_socket(1);
+    if(f->fd < 0) {
+      errors++;
+      free_flows[nb_free++] = f - flows;
+      break;
+    }
+
+    f->busy    = 1;
+    f->out_len = size;
+    fill_request(f->out, intended, seq);
+    flow_send(f);
+    break;
+  }
+
+  return 1;
+}
+
+static int outstanding(void)
+{
+  switch(mode) {
+  case MODE_TCP:
+    return nb_free < concurrency;
+  default:
+    return answers + errors < requests;
+  }
+}
+
+static void run(void)
+{
+  struct pollfd *fds = malloc(concurrency * sizeof(struct pollfd));
+  uint64_t start, end, total, seq = 0;
+  unsigned int i;
+
+  if(!fds)
+    err(EXIT_FAILURE, "cannot allocate poll set");
+
+  total = (uint64_t)duration * rate;
+  start = now_ns();
+  end   = start + (uint64_t)duration * 1000000000;
+
+  while(1) {
+    struct timespec ts, *timeout = NULL;
+    uint64_t now = now_ns(), next;
+    int n;
+
+    /* requests due, late ones keep their intended time */
+    for(; seq < total ; seq++) {
+      uint64_t intended = start + seq * 1000000000 / rate;
+
+      if(intended > now || !start_request(intended, seq))
+        break;
+    }
+
+    if(now >= end + DRAIN_TIME || (seq == total && !outstanding()))
+      break;
+
+    /* wait for the next request or the end of the drain */
+    next = end + DRAIN_TIME;
+    if(seq < total && (mode != MODE_TCP || nb_free))
+      next = start + seq * 1000000000 / rate;
+    if(next > now) {
+      ts = (struct timespec){ .tv_sec  = (next - now) / 1000000000,
+                              .tv_nsec = (next - now) % 1000000000 };
+    }
+    else
+      ts = (struct timespec){ 0, 0 };
+    timeout = &ts;
+
+    for(i = 0 ; i < concurrency ; i++) {
+      struct flow *f = &flows[i];
+
+      fds[i] = (struct pollfd){ .fd = f->fd, .events = POLLIN };
+      if(f->out_len)
+        fds[i].events |= POLLOUT;
+    }
+
+    n = ppoll(fds, concurrency, timeout, NULL);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      err(EXIT_FAILURE, "poll error");
+    }
+
+    for(i = 0 ; i < concurrency && n ; i++) {
+      struct flow *f = &flows[i];
+
+      if(!fds[i].revents || f->fd < 0)
+        continue;
+      n--;
+
+      if(fds[i].revents & POLLOUT)
+        flow_send(f);
+      if(f->fd >= 0 && fds[i].revents & (POLLIN | POLLERR | POLLHUP))
+        flow_recv(f);
+    }
+  }
+
+  /* connections still open never got their answer */
+  for(i = 0 ; i < concurrency ; i++)
+    if(flows[i].fd >= 0 && flows[i].busy)
+      close_flow(&flows[i]);
+
+  /* requests that could not even start are lost too */
+  requests = total;
+
+  free(fds);
+}
+
+static void print_header(void)
+{
+  printf("label,protocol,concurrency,size,rate,duration,requests,answers,lost,errors,"
+         "throughput,p50,p90,p99,p99.9,p99.99,max\n");
+}
+
+static void print_results(const char *label)
+{
+  static const double percentiles[] = { 50., 90., 99., 99.9, 99.99, 100. };
+  uint64_t count = 0;
+  unsigned int i, p = 0;
+
+  printf("%s,%s,%u,%lu,%u,%u,%llu,%llu,%llu,%llu,%.1f",
+         label, mode_names[mode], concurrency, (unsigned long)size, rate, duration,
+         (unsigned long long)requests, (unsigned long long)answers,
+         (unsigned long long)(requests - answers), (unsigned long long)errors,
+         (double)answers / duration);
+
+  /* latencies in us, upper bound of the bucket */
+  for(i = 0 ; i < HIST_BUCKETS && p < sizeof_array(percentiles) ; i++) {
+    count += hist[i];
+
+    while(answers && p < sizeof_array(percentiles) && count >= percentiles[p] / 100. * answers) {
+      printf(",%.3f", hist_upper(i) / 1000.);
+      p++;
+    }
+  }
+  for(; p < sizeof_array(percentiles) ; p++)
+    printf(",");
+
+  putchar('\n');
+}
+
+int main(int argc, char *argv[])
+{
+  struct addrinfo hints = { .ai_family = AF_UNSPEC };
+  const char *prog_name = argv[0];
+  const char *label = "-";
+  const char *host  = "127.0.0.1", *port = "7";
+  int c, n, header = 0;
+  unsigned int i;
+
+  while((c = getopt(argc, argv, "utkHc:s:r:d:l:")) != -1) {
+    switch(c) {
+    case 'u':
+      mode = MODE_UDP;
+      break;
+    case 't':
+      mode = MODE_TCP;
+      break;
+    case 'k':
+      mode = MODE_STREAM;
+      break;
+    case 'H':
+      header = 1;
+      break;
+    case 'c':
+      concurrency = atoi(optarg);
+      if(!concurrency)
+        errx(EXIT_FAILURE, "invalid concurrency");
+      break;
+    case 's':
+      size = atoi(optarg);
+      if(size < sizeof(struct probe))
+        errx(EXIT_FAILURE, "payload size must be at least %lu", (unsigned long)sizeof(struct probe));
+      break;
+    case 'r':
+      rate = atoi(optarg);
+      if(!rate)
+        errx(EXIT_FAILURE, "invalid rate");
+      break;
+    case 'd':
+      duration = atoi(optarg);
+      if(!duration)
+        errx(EXIT_FAILURE, "invalid duration");
+      break;
+    case 'l':
+      label = optarg;
+      break;
+    default:
+      usage(prog_name);
+    }
+  }
+
+  argc -= optind;
+  argv += optind;
+
+  if(argc > 1)
+    usage(prog_name);
+  if(argc == 1) {
+    host = strtok(argv[0], "/");
+    port = strtok(NULL, "/");
+    if(!port)
+      port = "7";
+  }
+
+  hints.ai_socktype = mode == MODE_UDP ? SOCK_DGRAM : SOCK_STREAM;
+  n = getaddrinfo(host, port, &hints, &server);
+  if(n)
+    errx(EXIT_FAILURE, "cannot resolve %s: %s", host, gai_strerror(n));
+
+  flows      = calloc(concurrency, sizeof(struct flow));
+  free_flows = calloc(concurrency, sizeof(int));
+  if(!flows || !free_flows)
+    err(EXIT_FAILURE, "cannot allocate flows");
+
+  for(i = 0 ; i < concurrency ; i++) {
+    struct flow *f = &flows[i];
+
+    f->fd  = -1;
+    f->out = malloc(mode == MODE_STREAM ? STREAM_BACKLOG * size : size);
+    f->in  = malloc(size);
+    if(!f->out || !f->in)
+      err(EXIT_FAILURE, "cannot allocate buffers");
+
+    if(mode == MODE_TCP)
+      free_flows[nb_free++] = i;
+    else
+      f->fd = open_socket(0);
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  run();
+
+  if(header)
+    print_header();
+  print_results(label);
+
+  return EXIT_SUCCESS;
+}
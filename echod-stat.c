@@ -0,0 +1,219 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <err.h>
+
+#include <gawen/common.h>
+
+#include "stats.h"
+
+static const char *counter_names[STAT_MAX] = {
+  [STAT_RX_PACKETS] = "rx packets",
+  [STAT_RX_BYTES]   = "rx bytes",
+  [STAT_TX_PACKETS] = "tx packets",
+  [STAT_TX_BYTES]   = "tx bytes",
+  [STAT_ACCEPTED]   = "accepted",
+  [STAT_DROPPED]    = "dropped",
+  [STAT_TIMEOUTS]   = "timeouts",
+  [STAT_TRUNCATED]  = "truncated",
+  [STAT_RX_ERRORS]  = "rx errors",
+  [STAT_TX_ERRORS]  = "tx errors",
+  [STAT_COALESCED]  = "coalesced",
+  [STAT_REAPED]     = "reaped",
+  [STAT_LIMITED]    = "limited"
+};
+
+static const char *hist_names[HIST_MAX] = {
+  [HIST_ACCEPT] = "accept to request",
+  [HIST_REPLY]  = "request to answer"
+};
+
+static const double percentiles[] = { 50., 90., 99., 99.9, 99.99, 100. };
+
+/* Values read from a slot at some point in time. */
+struct sample {
+  uint64_t counters[STAT_MAX];
+  uint64_t hist[HIST_MAX][HIST_BUCKETS];
+};
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-H] [-i seconds] stats-file\n", name);
+  exit(EXIT_FAILURE);
+}
+
+/* Copy the values of each listener, the daemon keeps updating them. */
+static void snapshot(const struct stats_listener *listeners, struct sample *samples)
+{
+  unsigned int i, j, k;
+
+  for(i = 0 ; i < STATS_MAX_LISTENERS ; i++) {
+    if(!listeners[i].pid)
+      continue;
+
+    for(j = 0 ; j < STAT_MAX ; j++)
+      samples[i].counters[j] = __atomic_load_n(&listeners[i].counters[j], __ATOMIC_RELAXED);
+    for(j = 0 ; j < HIST_MAX ; j++)
+      for(k = 0 ; k < HIST_BUCKETS ; k++)
+        samples[i].hist[j][k] = __atomic_load_n(&listeners[i].hist[j][k], __ATOMIC_RELAXED);
+  }
+}
+
+/* Display the percentiles of the samples recorded between
+   two snapshots. Each value is the upper bound of its bucket. */
+static void display_hist(const uint64_t *now, const uint64_t *before, const char *name)
+{
+  uint64_t total = 0, count = 0;
+  unsigned int i, p = 0;
+
+  for(i = 0 ; i < HIST_BUCKETS ; i++)
+    total += now[i] - before[i];
+
+  if(!total)
+    return;
+
+  printf("  %s (%llu samples, us)\n", name, (unsigned long long)total);
+  for(i = 0 ; i < HIST_BUCKETS && p < sizeof_array(percentiles) ; i++) {
+    count += now[i] - before[i];
+
+    while(p < sizeof_array(percentiles) && count >= percentiles[p] / 100. * total) {
+      printf("    p%-8g %14.3f\n", percentiles[p], hist_upper(i) / 1000.);
+      p++;
+    }
+  }
+}
+
+static void display(const struct stats_listener *listeners,
+                    const struct sample *now, const struct sample *before,
+                    unsigned int interval, int histograms)
+{
+  unsigned int i, j;
+
+  for(i = 0 ; i < STATS_MAX_LISTENERS ; i++) {
+    const struct stats_listener *l = &listeners[i];
+
+    if(!l->pid)
+      continue;
+
+    printf("%s (worker %u, pid %u)\n", l->name, l->worker, l->pid);
+    for(j = 0 ; j < STAT_MAX ; j++) {
+      printf("  %-12s %20llu", counter_names[j], (unsigned long long)now[i].counters[j]);
+      if(interval)
+        printf(" %14.1f/s", (double)(now[i].counters[j] - before[i].counters[j]) / interval);
+      putchar('\n');
+    }
+
+    if(histograms)
+      for(j = 0 ; j < HIST_MAX ; j++)
+        display_hist(now[i].hist[j], before[i].hist[j], hist_names[j]);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  const struct stats_header   *header;
+  const struct stats_listener *listeners;
+  struct sample *now, *before;
+  unsigned int interval = 0;
+  int histograms = 0;
+  struct stat st;
+  int c, fd;
+
+  while((c = getopt(argc, argv, "Hi:")) != -1) {
+    switch(c) {
+    case 'H':
+      histograms = 1;
+      break;
+    case 'i':
+      interval = atoi(optarg);
+      if(!interval)
+        errx(EXIT_FAILURE, "invalid interval");
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if(optind != argc - 1)
+    usage(argv[0]);
+
+  fd = open(argv[optind], O_RDONLY);
+  if(fd < 0)
+    err(EXIT_FAILURE, "cannot open %s", argv[optind]);
+
+  if(fstat(fd, &st) < 0)
+    err(EXIT_FAILURE, "cannot stat %s", argv[optind]);
+  if((size_t)st.st_size < sizeof(struct stats_header))
+    errx(EXIT_FAILURE, "%s: not a statistics file", argv[optind]);
+
+  header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if(header == MAP_FAILED)
+    err(EXIT_FAILURE, "cannot map %s", argv[optind]);
+  close(fd);
+
+  if(header->magic != STATS_MAGIC)
+    errx(EXIT_FAILURE, "%s: not a statistics file", argv[optind]);
+  if(header->version != STATS_VERSION)
+    errx(EXIT_FAILURE, "%s: unsupported version %u", argv[optind], header->version);
+  if((size_t)st.st_size < sizeof(struct stats_header) +
+                          STATS_MAX_LISTENERS * sizeof(struct stats_listener))
+    errx(EXIT_FAILURE, "%s: truncated statistics file", argv[optind]);
+
+  if(histograms && !(header->flags & STATS_LATENCY))
+    warnx("latency histograms are not enabled");
+
+  listeners = (const struct stats_listener *)(header + 1);
+
+  now    = calloc(STATS_MAX_LISTENERS, sizeof(struct sample));
+  before = calloc(STATS_MAX_LISTENERS, sizeof(struct sample));
+  if(!now || !before)
+    err(EXIT_FAILURE, "cannot allocate samples");
+
+  snapshot(listeners, now);
+  printf("pid %u, up %llds\n", header->pid, (long long)(time(NULL) - (time_t)header->start));
+  display(listeners, now, before, 0, histograms);
+
+  /* rates and latencies over each interval */
+  while(interval) {
+    struct sample *swap = before;
+    before = now;
+    now    = swap;
+
+    sleep(interval);
+
+    snapshot(listeners, now);
+    putchar('\n');
+    display(listeners, now, before, interval, histograms);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -26,9 +26,12 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -48,17 +51,28 @@
 #include "echod.h"
 #include "version.h"
 #include "sandbox.h"
+#include "event.h"
+#include "uring.h"
+#include "affinity.h"
+#include "buffer.h"
+#include "stats.h"
+#include "busy.h"
+#include "tcp.h"
+#include "ratelimit.h"
+#include "handoff.h"
+#include "evlog.h"
+#include "flow.h"
+#include "zerocopy.h"
+#include "twamp.h"
+#include "source.h"
+#include "packet.h"
 
-#define BUFFER_SIZE 4096
-#define BACKLOG     4
+/* Pipe size used to splice TCP streams. */
+#define SPLICE_PIPE_SIZE (1 << 20)
 
-/* Clear the buffer after each request to avoid
-   any potential heartbleed vulnerability. */
-#ifdef DO_CLEAR_BUFFER
-# define clear_buffer() memset(buffer, 0, sizeof(buffer))
-#else
-# define clear_buffer() (void)0
-#endif /* DO_CLEAR_BUFFER */
+/* Maximum number of datagrams answered on a socket before
+   we check the other sockets in the single process mode. */
+#define SINGLE_BUDGET 64
 
 /* presentation format for INET or INET6 sockaddr
    including port number in host order */
@@ -70,11 +84,48 @@ struct inetaddr {
 static int      sd;             /* socket descriptor */
 static int      af;             /* address family */
 static int      st;             /* socket type */
-struct sockaddr host_addr;      /* listen address */
+static unsigned int worker;     /* worker index for this address */
+static unsigned int listener;   /* statistics slot */
+static struct sockaddr_storage host_addr; /* listen address */
+
+/* Sockets served by the single process, with the state
+   of each listener restored before it is served. */
+struct listen_socket {
+  int sd;
+  int af;
+  int st;
+  unsigned int slot;
+  struct sockaddr_storage addr;
+  struct stats_listener *stats;
+  struct evlog_listener *evlog;
+
+  struct listen_socket *next;
+};
+
+static struct listen_socket *listen_sockets;
+static unsigned int nb_listen_sockets;
+
+/* The number of clients connected is the number of children spawned
+   minus those reaped. Each counter has a single writer, the handler
+   only increments the latter. */
+static unsigned int spawned;
+static unsigned int reaped;
+
+/* Listeners of the master, drained when the sockets are handed over. */
+struct child {
+  pid_t pid;
+
+  struct child *next;
+};
 
-static unsigned int clients; /* number of clients connected */
+static struct child *children;
+static int          *bound;   /* sockets bound or inherited */
+static unsigned int  nb_bound;
 
-static unsigned char buffer[BUFFER_SIZE];
+static unsigned char *buffer;      /* receive buffers for this worker */
+static size_t         buffer_size;
+static int            reflector;   /* answer TWAMP-light test packets */
+static unsigned int   burst;       /* datagrams sent for each one received by the source */
 
 struct host * add_host(struct host *hosts, const char *host, const char *port)
 {
@@ -87,6 +138,15 @@ struct host * add_host(struct host *hosts, const char *host, const char *port)
   return h;
 }
 
+static void add_child(pid_t pid)
+{
+  struct child *c = xmalloc(sizeof(struct child));
+
+  c->pid   = pid;
+  c->next  = children;
+  children = c;
+}
+
 void free_hosts(struct host *hosts)
 {
   while(hosts) {
@@ -96,13 +156,74 @@ void free_hosts(struct host *hosts)
   }
 }
 
-int bind_server(const struct host *hosts, unsigned long flags)
+/* The socket is served by a new child, or later by the single
+   process. Return 0 in the child and 1 in the parent. */
+static int spawn_listener(const struct sockaddr *addr, socklen_t addr_len,
+                          int socktype, unsigned int w, unsigned long flags)
+{
+  pid_t pid;
+
+  /* the master keeps the sockets to hand them over */
+  bound = realloc(bound, (nb_bound + 1) * sizeof(int));
+  if(!bound)
+    sysstd_abort("cannot allocate sockets");
+  bound[nb_bound++] = sd;
+
+  /* a single process serves all the sockets */
+  if(flags & SRV_SINGLE) {
+    struct listen_socket *l = xmalloc(sizeof(struct listen_socket));
+
+    *l = (struct listen_socket){ .sd   = sd,
+                                 .af   = addr->sa_family,
+                                 .st   = socktype,
+                                 .slot = listener++,
+                                 .next = listen_sockets };
+    memcpy(&l->addr, addr, addr_len);
+
+    listen_sockets = l;
+    nb_listen_sockets++;
+    return 1;
+  }
+
+  pid = fork();
+  if(!pid) { /* child */
+    af     = addr->sa_family;
+    st     = socktype;
+    worker = w;
+    memcpy(&host_addr, addr, addr_len);
+    return 0;
+  }
+  else if(pid < 0) /* error */
+    sysstd_abort("fork error");
+
+  /* parent */
+  add_child(pid);
+  listener++;
+  return 1;
+}
+
+static int spawn_single(void)
+{
+  pid_t pid = fork();
+
+  if(!pid) /* child */
+    return 0;
+  else if(pid < 0) /* error */
+    sysstd_abort("fork error");
+
+  add_child(pid);
+  return 1;
+}
+
+int bind_server(const struct host *hosts, const struct srv_config *config)
 {
+  unsigned long flags = config->flags;
   struct addrinfo *resolution, *r;
   struct addrinfo hints;
   const struct host *h;
-  pid_t pid;
-  int n, ret, optval = 1, resolved = 0;
+  unsigned int w;
+  int n, optval = 1, resolved = 0;
+  int v6only = !(flags & SRV_DUAL_STACK);
 
   for(h = hosts ; h ; h = h->next) {
     memset(&hints, 0, sizeof(hints));
@@ -155,29 +276,61 @@ int bind_server(const struct host *hosts, unsigned long flags)
         continue;
       }
 
+      /* the IPv6 any address also accepts IPv4 */
+      if(!v6only && !h->host && r->ai_family == AF_INET)
+        continue;
+
       /* From here all addresses match the filters applied on command line.
-         We bind to the specified address and fork a new child for listening. */
-      sd = xsocket(r->ai_family, r->ai_socktype, r->ai_protocol);
+         We bind to the specified address and fork a new child for listening.
+         With multiple workers, each one has its own socket bound to the same
+         address and the kernel spreads the flows among them. */
+      for(w = 0 ; w < config->workers ; w++) {
+        sd = xsocket(r->ai_family, r->ai_socktype, r->ai_protocol);
 
-      n = setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
-      if(n < 0)
-        sysstd_abort("cannot set socket options");
+        n = setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+        if(n < 0)
+          sysstd_abort("cannot set socket options");
 
-      xbind(sd, r->ai_addr, r->ai_addrlen);
+#ifdef SO_REUSEPORT
+        /* UDP flows share the port of the listening socket */
+        if(config->workers > 1 || (config->flows && r->ai_socktype == SOCK_DGRAM)) {
+          n = setsockopt(sd, SOL_SOCKET, REUSEPORT, &optval, sizeof(optval));
+          if(n < 0)
+            sysstd_abort("cannot set socket options");
+        }
+#endif
 
-      pid = fork();
-      if(!pid) { /* child */
-        af = r->ai_family;
-        st = r->ai_socktype;
-        memcpy(&host_addr, r->ai_addr, r->ai_addrlen);
+        /* Do not depend on the system default. Otherwise the IPv6
+           any address may conflict with the IPv4 one on Linux. */
+        if(r->ai_family == AF_INET6) {
+          n = setsockopt(sd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+          if(n < 0)
+            sysstd_abort("cannot set socket options");
+        }
 
-        freeaddrinfo(resolution);
-        ret = 0;
-        goto EXIT;
+        if(config->busy_poll)
+          busy_poll_socket(sd, config->busy_poll);
+
+        xbind(sd, r->ai_addr, r->ai_addrlen);
+
+        /* TCP sockets only join the group on listen(). The workers
+           listen here in order so that their index in the group is
+           the one the steering program expects. The listener calls
+           listen() again which only updates the backlog. */
+        if(flags & SRV_STEER_CPU && r->ai_socktype == SOCK_STREAM) {
+          xlisten(sd, config->backlog);
+          tcp_listen_options(sd, config);
+        }
+
+        /* the program applies to the whole group once complete */
+        if(flags & SRV_STEER_CPU && w == config->workers - 1)
+          steer_cpu(sd, config->workers);
+
+        if(!spawn_listener(r->ai_addr, r->ai_addrlen, r->ai_socktype, w, flags)) {
+          freeaddrinfo(resolution);
+          return 0;
+        }
       }
-      else if(pid < 0) /* error */
-        sysstd_abort("fork error");
-      /* parent (continue) */
     }
 
     freeaddrinfo(resolution);
@@ -186,56 +339,464 @@ int bind_server(const struct host *hosts, unsigned long flags)
   /* parent */
   if(!resolved)
     sysstd_abortx("no address resolved");
-  ret = 1;
-EXIT:
-  return ret;
+
+  if(flags & SRV_SINGLE)
+    return spawn_single();
+
+  return 1;
 }
 
-static void server_udp(void)
+int inherit_server(const int *fds, unsigned int nb_fds, const struct srv_config *config)
 {
-#ifdef __FreeBSD__
-  cap_rights_t rights;
-  cap_rights_init(&rights, CAP_RECV, CAP_SEND, CAP_CONNECT);
-  xcap_rights_limit(sd, &rights);
+  struct {
+    struct sockaddr_storage addr;
+    int st;
+  } *socks = xcalloc(nb_fds, sizeof(*socks));
+  unsigned int i, j, w, served = 0;
+
+  for(i = 0 ; i < nb_fds ; i++) {
+    socklen_t addr_len = sizeof(struct sockaddr_storage);
+    socklen_t len      = sizeof(st);
+
+    sd = fds[i];
+    if(getsockname(sd, (struct sockaddr *)&socks[i].addr, &addr_len) < 0 ||
+       getsockopt(sd, SOL_SOCKET, SO_TYPE, &st, &len) < 0)
+      sysstd_abort("cannot inspect inherited socket");
+    socks[i].st = st;
+
+    /* filter unwanted sockets */
+    switch(socks[i].addr.ss_family) {
+    case AF_INET:
+    case AF_INET6:
+      break;
+    default:
+      sysstd_log(LOG_WARNING, "ignoring inherited socket %d: not an IP socket", sd);
+      continue;
+    }
+    switch(st) {
+    case SOCK_DGRAM:
+    case SOCK_STREAM:
+      break;
+    default:
+      sysstd_log(LOG_WARNING, "ignoring inherited socket %d: neither UDP nor TCP", sd);
+      continue;
+    }
+
+    /* sockets bound to the same address are numbered as workers */
+    for(j = 0, w = 0 ; j < i ; j++)
+      if(socks[j].st == st && !memcmp(&socks[j].addr, &socks[i].addr, addr_len))
+        w++;
+
+    served++;
+    if(!spawn_listener((struct sockaddr *)&socks[i].addr, addr_len, st, w, config->flags)) {
+      free(socks);
+      return 0;
+    }
+  }
+
+  free(socks);
+
+  /* parent */
+  if(!served)
+    sysstd_abortx("no inherited socket to serve");
+
+  if(config->flags & SRV_SINGLE)
+    return spawn_single();
+
+  return 1;
+}
+
+int * server_sockets(unsigned int *nb)
+{
+  *nb = nb_bound;
+  return bound;
+}
+
+void drain_server(unsigned int timeout)
+{
+  struct child *c;
+
+  for(c = children ; c ; c = c->next)
+    kill(c->pid, SIGUSR2);
+
+  /* The master ignores SIGCHLD so the listeners are reaped by the
+     system and waitpid() fails once they have all exited. */
+  while(timeout--) {
+    if(waitpid(-1, NULL, WNOHANG) < 0 && errno == ECHILD)
+      return;
+    sleep(1);
+    evlog_flush();
+  }
+
+  sysstd_log(LOG_WARNING, "listeners still running after drain, terminating");
+  for(c = children ; c ; c = c->next)
+    kill(c->pid, SIGTERM);
+}
+
+/* Truncated datagrams are not answered, a partial echo
+   would look like a valid answer to the client. */
+static void udp_truncated(void)
+{
+  stat_inc(STAT_TRUNCATED);
+  evlog(EV_TRUNCATED, 0);
+}
+
+#ifdef MSG_WAITFORONE
+/* Receive up to batch datagrams per system call and answer
+   them all at once. Each slot has its own buffer and peer. */
+static void server_udp_batch(unsigned int batch)
+{
+  struct mmsghdr          *msgs;
+  struct mmsghdr          *answers;
+  struct iovec            *iovs;
+  struct sockaddr_storage *peers;
+  union twamp_control     *controls = NULL;
+  unsigned int i;
+
+  msgs    = xmalloc(batch * sizeof(struct mmsghdr));
+  answers = xmalloc(batch * sizeof(struct mmsghdr));
+  iovs    = xmalloc(batch * sizeof(struct iovec));
+  peers   = xmalloc(batch * sizeof(struct sockaddr_storage));
+  if(reflector)
+    controls = xmalloc(batch * sizeof(union twamp_control));
+
+  for(i = 0 ; i < batch ; i++) {
+    iovs[i] = (struct iovec){ .iov_base = buffer + i * buffer_size,
+                              .iov_len  = buffer_size };
+    msgs[i] = (struct mmsghdr){ .msg_hdr = { .msg_name   = &peers[i],
+                                             .msg_iov    = &iovs[i],
+                                             .msg_iovlen = 1 } };
+  }
+
+  while(1) {
+    unsigned int nb_answers = 0;
+    size_t rx_bytes = 0, tx_bytes = 0;
+    unsigned int limited = 0;
+    uint64_t received, now;
+    int n;
+
+    /* the peer address length is updated on each receive */
+    for(i = 0 ; i < batch ; i++) {
+      msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+      if(reflector) {
+        msgs[i].msg_hdr.msg_control    = controls[i].buf;
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i].buf);
+      }
+    }
+
+  RECV_INTR: /* syscall may be interrupted */
+    drain_check();
+    n = busy_recvmmsg(sd, msgs, batch, MSG_WAITFORONE | MSG_DONTWAIT);
+    if(n < 0) {
+      if(errno == EAGAIN) {
+        drain_wait(sd);
+        goto RECV_INTR;
+      }
+      if(errno == EINTR)
+        goto RECV_INTR;
+      sysstd_abort("receive error");
+    }
+    received = stat_clock();
+    now      = ratelimit_clock();
+
+    /* answer with the exact size of each datagram */
+    for(i = 0 ; i < (unsigned int)n ; i++) {
+      rx_bytes += msgs[i].msg_len;
+
+      if(msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        udp_truncated();
+        continue;
+      }
+
+#ifndef DISCARDD
+      if(!ratelimit((struct sockaddr *)&peers[i], 1, msgs[i].msg_len, now)) {
+        limited++;
+        continue;
+      }
 #endif
 
-  /* Sandboxing does not work for UDP yet.
-     The sendto() call is rejected in capsicum capability mode.
-     But we cannot connect beforehand because we use a single
-     thread per UDP sockets. */
-#if 0
-  sandbox();
+      iovs[i].iov_len = msgs[i].msg_len;
+#ifndef DISCARDD
+      if(reflector) {
+        iovs[i].iov_len = twamp_reflect(iovs[i].iov_base, msgs[i].msg_len,
+                                        buffer_size, &msgs[i].msg_hdr);
+        if(!iovs[i].iov_len)
+          continue;
+      }
+#endif
+
+      answers[nb_answers].msg_hdr = msgs[i].msg_hdr;
+      answers[nb_answers].msg_hdr.msg_control    = NULL;
+      answers[nb_answers].msg_hdr.msg_controllen = 0;
+      nb_answers++;
+      tx_bytes += iovs[i].iov_len;
+    }
+
+    /* a single update per batch */
+    stat_add(STAT_RX_PACKETS, n);
+    stat_add(STAT_RX_BYTES, rx_bytes);
+    if(limited)
+      stat_add(STAT_LIMITED, limited);
+
+#ifndef DISCARDD
+    /* a single transmit time for the whole batch */
+    if(reflector) {
+      uint64_t sent = twamp_now();
+      for(i = 0 ; i < nb_answers ; i++)
+        twamp_transmit(answers[i].msg_hdr.msg_iov->iov_base, sent);
+    }
+
+    for(i = 0 ; i < nb_answers ;) {
+      int sent = sendmmsg(sd, answers + i, nb_answers - i, 0);
+      if(sent < 0) {
+        if(errno == EINTR)
+          continue;
+        sysstd_abort("send error");
+      }
+      i += sent;
+    }
+
+    stat_add(STAT_TX_PACKETS, nb_answers);
+    stat_add(STAT_TX_BYTES, tx_bytes);
+    stat_record_n(HIST_REPLY, received, nb_answers);
+#else
+    UNUSED(tx_bytes);
+    UNUSED(received);
+    UNUSED(now);
+#endif
+
+    for(i = 0 ; i < (unsigned int)n ; i++)
+      iovs[i].iov_len = buffer_size;
+
+#ifdef DO_CLEAR_BUFFER
+    memset(buffer, 0, n * buffer_size);
 #endif
+  }
+}
+#endif /* MSG_WAITFORONE */
+
+#ifdef UDP_GRO
+/* The kernel coalesces the datagrams of a flow into a single one and
+   gives the size of each segment. We answer with a single segmented
+   send so the peer receives exactly the datagrams it sent. */
+static void server_udp_gro(void)
+{
+  int optval = 1;
+
+  if(setsockopt(sd, IPPROTO_UDP, UDP_GRO, &optval, sizeof(optval)) < 0)
+    sysstd_abort("cannot enable UDP GRO");
 
   while(1) {
     struct sockaddr_storage from;
-    socklen_t from_len = sizeof(from);
+    union {
+      char control[CMSG_SPACE(sizeof(int))];
+      struct cmsghdr align;
+    } cmsg_buf;
+    struct iovec  iov = { .iov_base = buffer, .iov_len = GRO_BUFFER_SIZE };
+    struct msghdr msg = { .msg_name       = &from,
+                          .msg_namelen    = sizeof(from),
+                          .msg_iov        = &iov,
+                          .msg_iovlen     = 1,
+                          .msg_control    = cmsg_buf.control,
+                          .msg_controllen = sizeof(cmsg_buf.control) };
+    struct cmsghdr *cmsg;
+    unsigned int segments = 1;
+    uint64_t received;
+    int gso_size = 0;
     ssize_t n;
 
   INTR: /* syscall may be interrupted */
-    n = recvfrom(sd, buffer, BUFFER_SIZE, 0, (struct sockaddr *)&from, &from_len);
+    drain_check();
+    n = busy_recvmsg(sd, &msg, MSG_DONTWAIT);
     if(n < 0) {
+      if(errno == EAGAIN) {
+        drain_wait(sd);
+        goto INTR;
+      }
       if(errno == EINTR)
         goto INTR;
       sysstd_abort("receive error");
     }
+    received = stat_clock();
+
+    for(cmsg = CMSG_FIRSTHDR(&msg) ; cmsg ; cmsg = CMSG_NXTHDR(&msg, cmsg))
+      if(cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO)
+        memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(int));
+
+    /* the last segment may be shorter */
+    if(gso_size && n > gso_size) {
+      segments = (n + gso_size - 1) / gso_size;
+      stat_add(STAT_COALESCED, segments);
+    }
+    else
+      gso_size = 0;
+
+    stat_add(STAT_RX_PACKETS, segments);
+    stat_add(STAT_RX_BYTES, n);
+
+    /* each segment is subject to the buffer size */
+    if(msg.msg_flags & MSG_TRUNC || (size_t)(gso_size ? gso_size : n) > buffer_size) {
+      udp_truncated();
+      continue;
+    }
 
 #ifndef DISCARDD
-    /* answer */
-    n = sendto(sd, buffer, n, 0, (struct sockaddr *)&from, from_len);
+    if(!ratelimit((struct sockaddr *)&from, segments, n, ratelimit_clock())) {
+      stat_add(STAT_LIMITED, segments);
+      continue;
+    }
+
+    /* answer, segmented as received */
+    iov.iov_len        = n;
+    msg.msg_controllen = 0;
+    if(gso_size) {
+      uint16_t segment_size = gso_size;
+
+      msg.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+      cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = IPPROTO_UDP;
+      cmsg->cmsg_type  = UDP_SEGMENT;
+      cmsg->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+      memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(uint16_t));
+    }
+
+    n = sendmsg(sd, &msg, 0);
     if(n < 0)
       sysstd_abort("send error");
+
+    stat_add(STAT_TX_PACKETS, segments);
+    stat_add(STAT_TX_BYTES, n);
+    stat_record_n(HIST_REPLY, received, segments);
+#else
+    UNUSED(received);
 #endif
 
-    clear_buffer();
+#ifdef DO_CLEAR_BUFFER
+    memset(buffer, 0, GRO_BUFFER_SIZE);
+#endif
+  }
+}
+#endif /* UDP_GRO */
+
+#ifndef DISCARDD
+/* Answer a datagram with a burst of datagrams of the same size taken
+   from the pattern. The rate limit accounts for the whole burst. */
+static void udp_source(const struct sockaddr *from, socklen_t from_len,
+                       size_t size, uint64_t received)
+{
+  int sent;
+
+  if(!size)
+    size = SOURCE_DATAGRAM;
+
+  if(!ratelimit(from, burst, burst * size, ratelimit_clock())) {
+    stat_inc(STAT_LIMITED);
+    return;
+  }
+
+  sent = source_burst(sd, from, from_len, size, burst);
+  if(sent < 0) {
+    stat_inc(STAT_TX_ERRORS);
+    evlog(EV_SEND_ERROR, errno);
+    return;
+  }
+
+  stat_add(STAT_TX_PACKETS, sent);
+  stat_add(STAT_TX_BYTES, sent * size);
+  stat_record(HIST_REPLY, received);
+}
+#endif
+
+/* Answer a single datagram. Return 0 when there is no datagram to
+   receive on a non-blocking call, that is with MSG_DONTWAIT. */
+static int udp_echo(int flags)
+{
+  struct sockaddr_storage from;
+  union twamp_control control;
+  struct iovec  iov = { .iov_base = buffer, .iov_len = buffer_size };
+  struct msghdr msg = { .msg_name       = &from,
+                        .msg_namelen    = sizeof(from),
+                        .msg_iov        = &iov,
+                        .msg_iovlen     = 1,
+                        .msg_control    = reflector ? control.buf : NULL,
+                        .msg_controllen = reflector ? sizeof(control.buf) : 0 };
+  uint64_t received;
+  ssize_t n;
+
+INTR: /* syscall may be interrupted */
+  drain_check();
+  n = busy_recvmsg(sd, &msg, flags | MSG_DONTWAIT);
+  if(n < 0) {
+    if(errno == EINTR)
+      goto INTR;
+    if(errno == EAGAIN && flags & MSG_DONTWAIT)
+      return 0;
+    if(errno == EAGAIN) {
+      drain_wait(sd);
+      goto INTR;
+    }
+    sysstd_abort("receive error");
   }
+  received = stat_clock();
+
+  stat_inc(STAT_RX_PACKETS);
+  stat_add(STAT_RX_BYTES, n);
+
+  if(msg.msg_flags & MSG_TRUNC) {
+    udp_truncated();
+    return 1;
+  }
+
+#ifndef DISCARDD
+  if(burst) {
+    udp_source((struct sockaddr *)&from, msg.msg_namelen, n, received);
+    return 1;
+  }
+
+  if(!ratelimit((struct sockaddr *)&from, 1, n, ratelimit_clock())) {
+    stat_inc(STAT_LIMITED);
+    return 1;
+  }
+
+  if(reflector) {
+    n = twamp_reflect(buffer, n, buffer_size, &msg);
+    if(!n)
+      return 1;
+    twamp_transmit(buffer, twamp_now());
+  }
+
+  /* answer */
+  n = sendto(sd, buffer, n, 0, (struct sockaddr *)&from, msg.msg_namelen);
+  if(n < 0)
+    sysstd_abort("send error");
+
+  stat_inc(STAT_TX_PACKETS);
+  stat_add(STAT_TX_BYTES, n);
+  stat_record(HIST_REPLY, received);
+#else
+  UNUSED(received);
+#endif
+
+  clear_buffer();
+  return 1;
 }
 
+/* Signals coalesce when multiple children exit at once
+   so we reap every child that has exited so far. */
 static void sig_chld(int signum)
 {
+  int saved_errno = errno;
+  pid_t pid;
+
   UNUSED(signum);
-  clients--;
-  wait(NULL);
+
+  while((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+    flow_exited(pid);
+    __atomic_add_fetch(&reaped, 1, __ATOMIC_RELAXED);
+    stat_inc(STAT_REAPED);
+  }
+
+  errno = saved_errno;
 }
 
 static void sockaddr_ntop(const struct sockaddr *addr, struct inetaddr *pres, int af)
@@ -264,7 +825,8 @@ static void sockaddr_ntop(const struct sockaddr *addr, struct inetaddr *pres, in
   inet_ntop(af, addr_in, pres->addr, sizeof(pres->addr));
 }
 
-static void rename_listen_child(void)
+/* Name of the listener, such as 127.0.0.1/7.UDP */
+static void listener_name(char *name, size_t size)
 {
   struct inetaddr pres;
   const char *st_s;
@@ -280,9 +842,24 @@ static void rename_listen_child(void)
     assert(0);
   }
 
-  sockaddr_ntop(&host_addr, &pres, af);
+  sockaddr_ntop((struct sockaddr *)&host_addr, &pres, af);
+  snprintf(name, size, "%s/%d.%s", pres.addr, pres.port, st_s);
+}
+
+static void rename_listen_child(const struct srv_config *config)
+{
+  char name[sizeof(((struct stats_listener *)0)->name)];
+
+  listener_name(name, sizeof(name));
 
-  setproctitle("listen on %s/%d.%s", pres.addr, pres.port, st_s);
+  if(config->workers > 1)
+    setproctitle("listen on %s (worker %u)", name, worker);
+  else
+    setproctitle("listen on %s", name);
+
+  /* the statistics and the events use the same name */
+  stats_attach(listener, name, worker);
+  evlog_attach(listener, name);
 }
 
 static void rename_client_child(const struct sockaddr *addr)
@@ -292,115 +869,971 @@ static void rename_client_child(const struct sockaddr *addr)
   setproctitle("connection from %s/%d", pres.addr, pres.port);
 }
 
-static void server_tcp(unsigned int max_clients, unsigned int timeout)
+/* Receive error on a client connection, always return -1.
+   With SO_RCVTIMEO a timeout is reported as EAGAIN. */
+static int client_recv_error(unsigned int timeout)
 {
-  struct timeval timeout_tv;
+  if(errno == EAGAIN && timeout) { /* probably a timeout */
+    stat_inc(STAT_TIMEOUTS);
+    evlog(EV_TIMEOUT, 0);
+  }
+  else {
+    stat_inc(STAT_RX_ERRORS);
+    evlog(EV_RECV_ERROR, errno);
+  }
 
-#ifdef __FreeBSD__
-  cap_rights_t rights;
-  cap_rights_init(&rights, CAP_LISTEN, CAP_ACCEPT, CAP_RECV, CAP_SEND , CAP_SETSOCKOPT);
-  xcap_rights_limit(sd, &rights);
-#endif
+  return -1;
+}
 
-  xlisten(sd, BACKLOG);
+#ifndef DISCARDD
+static int client_send_error(void)
+{
+  stat_inc(STAT_TX_ERRORS);
+  evlog(EV_SEND_ERROR, errno);
+  return -1;
+}
+#endif
 
-  /* We cannot use SA_NOCLDWAIT here because we have no
-     guarantee that a signal would still be generated.
-     Linux for example still does, FreeBSD does not.
-     Yet we do need the signal to decrement clients. */
-  signal(SIGCHLD, sig_chld);
+/* Answer a single request.
+   Return 0 on success and -1 on error. */
+static int serve_once(int fd, const struct srv_config *config, uint64_t accepted)
+{
+  uint64_t received;
+  ssize_t n;
 
-  timeout   *= 1000; /* ms to us */
-  timeout_tv = (struct timeval){ .tv_sec  = timeout / 1000000,
-                                 .tv_usec = timeout % 1000000 };
+INTR: /* syscall may be interrupted */
+  n = busy_recv(fd, buffer, buffer_size, 0);
+  if(n < 0) {
+    if(errno == EINTR)
+      goto INTR;
+    return client_recv_error(config->timeout);
+  }
+  received = stat_request(&accepted);
 
-  while(1) {
-    struct sockaddr_storage from;
-    socklen_t from_len = sizeof(from);
-    pid_t pid;
-    ssize_t n;
-    int fd;
+  stat_inc(STAT_RX_PACKETS);
+  stat_add(STAT_RX_BYTES, n);
 
-  ACPT_INTR: /* syscall may be interrupted */
-    fd = accept(sd, (struct sockaddr *)&from, &from_len);
-    if(fd < 0) {
-      if(errno == EINTR)
-        goto ACPT_INTR;
-      sysstd_abort("accept error");
-    }
+#ifndef DISCARDD
+  /* answer */
+  n = zerocopy_send(fd, buffer, n);
+  if(n < 0)
+    return client_send_error();
 
-#ifdef __FreeBSD__
-    cap_rights_init(&rights, CAP_RECV, CAP_SEND , CAP_SETSOCKOPT);
-    xcap_rights_limit(fd, &rights);
+  stat_inc(STAT_TX_PACKETS);
+  stat_add(STAT_TX_BYTES, n);
+  stat_record(HIST_REPLY, received);
+#else
+  UNUSED(received);
 #endif
 
-    if(max_clients && clients >= max_clients) {
-      close(fd);
-      sysstd_log(LOG_DEBUG, "connection dropped: maximum number of clients reached (%d)", clients);
-      continue;
-    }
-    else
-      clients++;
-
-    /* fork again to handle connection */
-    pid = fork();
-    if(!pid) { /* child */
-      sandbox();
-      rename_client_child((struct sockaddr *)&from);
-      close(sd); /* close unused FD */
-
-      /* configure timeout limit */
-      if(timeout)
-        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout_tv, sizeof(struct timeval));
-
-    RECV_INTR: /* syscall may be interrupted */
-      n = recv(fd, buffer, BUFFER_SIZE, 0);
-      if(n < 0) {
-        switch(errno) {
-        case EINTR:
-          /* syscall interrupted */
-          goto RECV_INTR;
-        case EAGAIN:
-          if(timeout) { /* probably a timeout */
-            sysstd_log(LOG_DEBUG, "connection timeout");
-            exit(1);
-          }
-          break;
-        default:
-          sysstd_abort("receive error");
-        }
-      }
+  /* A child of the fork engine exits with its buffer while the
+     kernel keeps the pages it sends from, so it does not hold a
+     client slot until the answer is acknowledged. */
+  if(config->engine == ENGINE_FORK)
+    return 0;
 
-#ifndef DISCARDD
-      /* answer */
-      n = send(fd, buffer, n, 0);
-      if(n < 0)
-        sysstd_abort("send error");
-#endif
+  /* The buffer is cleared or reused by the next client of a
+     prefork worker, but only once the kernel released it.
+     Otherwise this worker is replaced with a new buffer. */
+  if(zerocopy_wait(fd) < 0) {
+    evlog(EV_ZEROCOPY, 0);
+    exit(EXIT_FAILURE);
+  }
 
-      /* We answered the client.
-         Now we can exit. */
-      exit(0);
-    }
-    else if(pid < 0) /* error */
-      sysstd_abort("fork error");
+  clear_buffer();
 
-    /* parent (continue) */
-    close(fd);
-  }
+  return 0;
 }
 
-void server(unsigned int max_clients, unsigned int timeout)
+#if defined(__linux__) && !defined(DISCARDD)
+/* Move the stream from the socket to a pipe and back to the
+   socket so that the payload never goes through user space.
+   Return 0 on success and -1 on error. */
+static int serve_stream(int fd, const struct srv_config *config, uint64_t accepted)
 {
+  int pipefd[2], ret = 0;
+
+  if(pipe(pipefd) < 0) {
+    sysstd_warn(LOG_ERR, "cannot create pipe");
+    return -1;
+  }
+
+  /* A larger pipe moves more data per splice.
+     This is only a hint, the default size still works. */
+  fcntl(pipefd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+
+  while(1) {
+    uint64_t received;
+    ssize_t n, m;
+
+    busy_wait(fd);
+    n = splice(fd, NULL, pipefd[1], NULL, SPLICE_PIPE_SIZE, SPLICE_F_MOVE);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      ret = client_recv_error(config->timeout);
+      break;
+    }
+    else if(n == 0) /* end of stream */
+      break;
+    received = stat_request(&accepted);
+    tcp_quickack(fd, config);
+
+    stat_inc(STAT_RX_PACKETS);
+    stat_add(STAT_RX_BYTES, n);
+
+    /* answer */
+    while(n > 0) {
+      m = splice(pipefd[0], NULL, fd, NULL, n, SPLICE_F_MOVE);
+      if(m < 0) {
+        if(errno == EINTR)
+          continue;
+        ret = client_send_error();
+        goto EXIT;
+      }
+      n -= m;
+      stat_add(STAT_TX_BYTES, m);
+    }
+    stat_inc(STAT_TX_PACKETS);
+    stat_record(HIST_REPLY, received);
+  }
+
+EXIT:
+  close(pipefd[0]);
+  close(pipefd[1]);
+
+  return ret;
+}
+#else
+/* Answer until the client closes the connection.
+   Return 0 on success and -1 on error. */
+static int serve_stream(int fd, const struct srv_config *config, uint64_t accepted)
+{
+  while(1) {
+    uint64_t received;
+    ssize_t n;
+
+    n = busy_recv(fd, buffer, buffer_size, 0);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      return client_recv_error(config->timeout);
+    }
+    else if(n == 0) /* end of stream */
+      break;
+    received = stat_request(&accepted);
+    tcp_quickack(fd, config);
+
+    stat_inc(STAT_RX_PACKETS);
+    stat_add(STAT_RX_BYTES, n);
+
+#ifndef DISCARDD
+    /* answer */
+    while(n > 0) {
+      ssize_t m = send(fd, buffer, n, 0);
+      if(m < 0) {
+        if(errno == EINTR)
+          continue;
+        return client_send_error();
+      }
+
+      /* partial send (interrupted) */
+      n -= m;
+      memmove(buffer, buffer + m, n);
+      stat_add(STAT_TX_BYTES, m);
+    }
+    stat_inc(STAT_TX_PACKETS);
+    stat_record(HIST_REPLY, received);
+#else
+    UNUSED(received);
+#endif
+
+    clear_buffer();
+  }
+
+  return 0;
+}
+#endif
+
+#ifndef DISCARDD
+/* Send the pattern until the client closes the connection. The
+   connection is dropped when the client does not read anything
+   within the timeout. Return 0 on success and -1 on error. */
+static int serve_source(int fd, const struct srv_config *config, const struct timeval *timeout_tv)
+{
+  uint64_t pos = 0;
+  ssize_t n;
+
+  /* the client closes the connection to stop */
+  signal(SIGPIPE, SIG_IGN);
+
+  if(config->timeout)
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, timeout_tv, sizeof(struct timeval));
+
+  while(1) {
+    n = source_send(fd, &pos, SOURCE_CHUNK);
+    if(n < 0) {
+      switch(errno) {
+      case EINTR:
+        continue;
+      case EPIPE:
+      case ECONNRESET:
+        return 0;
+      case EAGAIN:
+        stat_inc(STAT_TIMEOUTS);
+        evlog(EV_TIMEOUT, 0);
+        return -1;
+      default:
+        return client_send_error();
+      }
+    }
+
+    stat_inc(STAT_TX_PACKETS);
+    stat_add(STAT_TX_BYTES, n);
+  }
+}
+#endif
+
+/* Serve a connection accepted on the listening socket.
+   Return 0 on success and -1 on error. */
+static int serve_client(int fd, const struct sockaddr *from, const struct srv_config *config,
+                        const struct timeval *timeout_tv, uint64_t accepted)
+{
+  rename_client_child(from);
+
+  /* configure timeout limit */
+  if(config->timeout)
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, timeout_tv, sizeof(struct timeval));
+
+  tcp_quickack(fd, config);
+  zerocopy_socket(fd);
+
+#ifndef DISCARDD
+  if(config->flags & SRV_SOURCE)
+    return serve_source(fd, config, timeout_tv);
+#endif
+
+  if(config->flags & SRV_STREAM)
+    return serve_stream(fd, config, accepted);
+  else
+    return serve_once(fd, config, accepted);
+}
+
+/* Errors of accept() which do not concern the listening socket.
+   Return 1 when we should accept again, after a pause when the
+   process or the system ran out of resources. */
+static int accept_retry(int err)
+{
+  switch(err) {
+  case EINTR:
+  case ECONNABORTED: /* reset before we accepted it */
+    return 1;
+  case EMFILE:
+  case ENFILE:
+  case ENOBUFS:
+  case ENOMEM:
+    evlog(EV_ACCEPT_ERROR, err);
+    poll(NULL, 0, ACCEPT_BACKOFF);
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/* Serve the connections of the listening socket forever. */
+static void prefork_worker(const struct srv_config *config, const struct timeval *timeout_tv)
+{
+  sigset_t drain_set;
+
+#ifdef __FreeBSD__
+  cap_rights_t rights;
+#endif
+
+  sandbox();
+
+  /* a client that resets the connection must not kill the worker */
+  signal(SIGPIPE, SIG_IGN);
+
+  /* the master waits for both signals */
+  sigemptyset(&drain_set);
+  sigaddset(&drain_set, SIGCHLD);
+  sigaddset(&drain_set, SIGUSR2);
+  sigprocmask(SIG_UNBLOCK, &drain_set, NULL);
+
+  /* the client is served before we drain */
+  sigemptyset(&drain_set);
+  sigaddset(&drain_set, SIGUSR2);
+
+  while(1) {
+    struct sockaddr_storage from;
+    socklen_t from_len = sizeof(from);
+    uint64_t accepted;
+    int fd;
+
+    drain_check();
+    busy_wait(sd);
+    fd = accept(sd, (struct sockaddr *)&from, &from_len);
+    if(fd < 0) {
+      /* another worker took the connection */
+      if(errno == EAGAIN) {
+        drain_wait(sd);
+        continue;
+      }
+      if(accept_retry(errno))
+        continue;
+      sysstd_abort("accept error");
+    }
+    accepted = stat_clock();
+
+    stat_inc(STAT_ACCEPTED);
+
+#ifdef __FreeBSD__
+    cap_rights_init(&rights, CAP_RECV, CAP_SEND , CAP_SETSOCKOPT);
+    xcap_rights_limit(fd, &rights);
+
+    /* FreeBSD inherits the flag of the listening socket */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+#endif
+
+    sigprocmask(SIG_BLOCK, &drain_set, NULL);
+    serve_client(fd, (struct sockaddr *)&from, config, timeout_tv, accepted);
+    close(fd);
+    sigprocmask(SIG_UNBLOCK, &drain_set, NULL);
+  }
+}
+
+/* Only there so that the signal is not discarded, see sigwait(). */
+static void sig_wait(int signum)
+{
+  UNUSED(signum);
+}
+
+static pid_t spawn_prefork_worker(const struct srv_config *config, const struct timeval *timeout_tv)
+{
+  pid_t pid = fork();
+
+  if(!pid) /* child */
+    prefork_worker(config, timeout_tv);
+  else if(pid < 0)
+    sysstd_abort("fork error");
+
+  return pid;
+}
+
+/* A fixed pool of max_clients workers accept and serve the connections.
+   The connections are never dropped, they wait in the listen queue. */
+static void server_tcp_prefork(const struct srv_config *config, const struct timeval *timeout_tv)
+{
+  pid_t *workers = xmalloc(config->max_clients * sizeof(pid_t));
+  sigset_t wait_set;
+  unsigned int i;
+
+  /* We wait for the workers and the drain ourselves. Both signals are
+     blocked and taken in turn so that the drain cannot be missed while
+     we wait. The handler keeps SIGCHLD from being discarded. */
+  signal(SIGCHLD, sig_wait);
+  sigemptyset(&wait_set);
+  sigaddset(&wait_set, SIGCHLD);
+  sigaddset(&wait_set, SIGUSR2);
+  sigprocmask(SIG_BLOCK, &wait_set, NULL);
+
+  for(i = 0 ; i < config->max_clients ; i++)
+    workers[i] = spawn_prefork_worker(config, timeout_tv);
+
+  /* respawn the workers which exit */
+  while(!draining) {
+    int signum;
+    pid_t pid;
+
+    if(sigwait(&wait_set, &signum))
+      sysstd_abort("sigwait error");
+    if(signum == SIGUSR2)
+      break;
+
+    while((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+      sysstd_log(LOG_WARNING, "prefork worker %d exited, respawning", (int)pid);
+      for(i = 0 ; i < config->max_clients ; i++)
+        if(workers[i] == pid)
+          workers[i] = spawn_prefork_worker(config, timeout_tv);
+    }
+  }
+
+  /* the workers drain as well */
+  for(i = 0 ; i < config->max_clients ; i++)
+    kill(workers[i], SIGUSR2);
+  while(wait(NULL) > 0 || errno == EINTR);
+
+  drain_exit();
+}
+
+/* We cannot use SA_NOCLDWAIT here because we have no
+   guarantee that a signal would still be generated.
+   Linux for example still does, FreeBSD does not.
+   Yet we do need the signal to count the clients. */
+static void setup_sig_chld(void)
+{
+  struct sigaction act_chld = { .sa_handler = sig_chld,
+                                .sa_flags   = SA_RESTART | SA_NOCLDSTOP };
+
+  sigaction(SIGCHLD, &act_chld, NULL);
+}
+
+static void listen_tcp(const struct srv_config *config)
+{
+#ifdef __FreeBSD__
+  cap_rights_t rights;
+  cap_rights_init(&rights, CAP_LISTEN, CAP_ACCEPT, CAP_RECV, CAP_SEND , CAP_SETSOCKOPT);
+  xcap_rights_limit(sd, &rights);
+#endif
+
+  xlisten(sd, config->backlog);
+  tcp_listen_options(sd, config);
+}
+
+static struct timeval client_timeout(const struct srv_config *config)
+{
+  unsigned int timeout = config->timeout * 1000; /* ms to us */
+
+  return (struct timeval){ .tv_sec  = timeout / 1000000,
+                           .tv_usec = timeout % 1000000 };
+}
+
+/* Accept a client and fork a child to serve it. Return 0 when there
+   is no connection to accept on a non-blocking listening socket. */
+static int accept_fork(const struct srv_config *config, const struct timeval *timeout_tv)
+{
+  struct sockaddr_storage from;
+  socklen_t from_len = sizeof(from);
+  unsigned int clients;
+  uint64_t accepted;
+  pid_t pid;
+  int fd;
+
+#ifdef __FreeBSD__
+  cap_rights_t rights;
+#endif
+
+ACPT_INTR: /* syscall may be interrupted */
+  drain_check();
+  busy_wait(sd);
+  fd = accept(sd, (struct sockaddr *)&from, &from_len);
+  if(fd < 0) {
+    /* the client may have given up since the socket was ready */
+    if((errno == EAGAIN || errno == ECONNABORTED) && config->flags & SRV_SINGLE)
+      return 0;
+    if(errno == EAGAIN) {
+      drain_wait(sd);
+      goto ACPT_INTR;
+    }
+    if(accept_retry(errno))
+      goto ACPT_INTR;
+    sysstd_abort("accept error");
+  }
+  accepted = stat_clock();
+
+#ifdef __FreeBSD__
+  cap_rights_init(&rights, CAP_RECV, CAP_SEND , CAP_SETSOCKOPT);
+  xcap_rights_limit(fd, &rights);
+#endif
+
+  clients = spawned - __atomic_load_n(&reaped, __ATOMIC_RELAXED);
+  if(config->max_clients && clients >= config->max_clients) {
+    close(fd);
+    stat_inc(STAT_DROPPED);
+    evlog(EV_DROPPED, 0);
+    return 1;
+  }
+
+  /* fork again to handle connection */
+  pid = fork();
+  if(!pid) { /* child */
+    sandbox();
+
+    /* close unused FD */
+    if(config->flags & SRV_SINGLE) {
+      struct listen_socket *l;
+      for(l = listen_sockets ; l ; l = l->next)
+        close(l->sd);
+    }
+    else
+      close(sd);
+
+    /* FreeBSD inherits the flag of the listening socket */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    /* We answered the client.
+       Now we can exit. */
+    exit(serve_client(fd, (struct sockaddr *)&from, config, timeout_tv, accepted) ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+  else if(pid < 0) { /* error */
+    /* out of processes, the listener itself must survive */
+    if(errno != EAGAIN)
+      sysstd_abort("fork error");
+    stat_inc(STAT_DROPPED);
+    evlog(EV_FORK_FAILED, errno);
+  }
+  else {
+    spawned++;
+    stat_inc(STAT_ACCEPTED);
+  }
+
+  /* parent (continue) */
+  close(fd);
+  return 1;
+}
+
+/* Answer the datagrams of a peer on its own connected socket until it
+   stays idle for too long. Return 0 when the flow expired and -1 on error. */
+static int serve_flow(int fd, const struct sockaddr *peer, const struct srv_config *config)
+{
+  struct timeval timeout_tv = { .tv_sec = config->flow_timeout };
+  struct iovec  iov = { .iov_base = buffer, .iov_len = buffer_size };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+  uint64_t received;
+  ssize_t n;
+
+  if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout_tv, sizeof(timeout_tv)) < 0)
+    sysstd_abort("cannot set socket timeout");
+
+  rename_client_child(peer);
+
+  while(1) {
+    /* the peer closed its socket when we get ECONNREFUSED */
+    n = busy_recvmsg(fd, &msg, 0);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      if(errno == EAGAIN || errno == ECONNREFUSED)
+        return 0;
+      stat_inc(STAT_RX_ERRORS);
+      evlog(EV_RECV_ERROR, errno);
+      return -1;
+    }
+    received = stat_clock();
+
+    stat_inc(STAT_RX_PACKETS);
+    stat_add(STAT_RX_BYTES, n);
+
+    if(msg.msg_flags & MSG_TRUNC) {
+      udp_truncated();
+      continue;
+    }
+
+#ifndef DISCARDD
+    if(!ratelimit(peer, 1, n, ratelimit_clock())) {
+      stat_inc(STAT_LIMITED);
+      continue;
+    }
+
+    n = send(fd, buffer, n, 0);
+    if(n < 0) {
+      if(errno == ECONNREFUSED)
+        return 0;
+      return client_send_error();
+    }
+
+    stat_inc(STAT_TX_PACKETS);
+    stat_add(STAT_TX_BYTES, n);
+    stat_record(HIST_REPLY, received);
+#else
+    UNUSED(received);
+#endif
+
+    clear_buffer();
+  }
+}
+
+/* Answer the datagrams waiting on a flow before it was connected,
+   they may come from any peer so we answer on the shared socket. */
+static void flow_strays(int fd)
+{
+  struct sockaddr_storage from;
+  struct iovec  iov = { .iov_base = buffer, .iov_len = buffer_size };
+  struct msghdr msg = { .msg_name = &from, .msg_iov = &iov, .msg_iovlen = 1 };
+  ssize_t n;
+
+  while(1) {
+    msg.msg_namelen = sizeof(from);
+    n = recvmsg(fd, &msg, MSG_DONTWAIT);
+    if(n < 0)
+      return;
+
+    stat_inc(STAT_RX_PACKETS);
+    stat_add(STAT_RX_BYTES, n);
+
+    if(msg.msg_flags & MSG_TRUNC) {
+      udp_truncated();
+      continue;
+    }
+
+#ifndef DISCARDD
+    n = sendto(sd, buffer, n, 0, (struct sockaddr *)&from, msg.msg_namelen);
+    if(n < 0)
+      sysstd_abort("send error");
+
+    stat_inc(STAT_TX_PACKETS);
+    stat_add(STAT_TX_BYTES, n);
+#endif
+  }
+}
+
+/* Each new peer gets its own socket connected to it and a child that
+   serves it in a sandbox. The shared socket only receives the first
+   datagram of each flow, or each datagram when there is no room left
+   for a new flow, and answers it as usual. */
+static void server_udp_flows(const struct srv_config *config)
+{
+  union flow_control control;
+  struct sockaddr_storage from, local;
+  struct iovec  iov;
+  struct msghdr msg = { .msg_name = &from, .msg_iov = &iov, .msg_iovlen = 1 };
+  sigset_t chld, saved;
+  unsigned int active;
+  uint64_t received;
+  ssize_t n;
+  pid_t pid;
+  int fd;
+
+#ifdef __FreeBSD__
+  cap_rights_t rights;
+#endif
+
+  buffer = alloc_buffers(buffer_size, 1, config->flags & SRV_HUGE_PAGES);
+  iov    = (struct iovec){ .iov_base = buffer, .iov_len = buffer_size };
+
+  flow_init(config->flows);
+  flow_recv_destination(sd, af);
+  setup_sig_chld();
+
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+
+  while(1) {
+    msg.msg_namelen    = sizeof(from);
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    drain_check();
+    n = busy_recvmsg(sd, &msg, MSG_DONTWAIT);
+    if(n < 0) {
+      if(errno == EAGAIN) {
+        drain_wait(sd);
+        continue;
+      }
+      if(errno == EINTR)
+        continue;
+      sysstd_abort("receive error");
+    }
+    received = stat_clock();
+
+    stat_inc(STAT_RX_PACKETS);
+    stat_add(STAT_RX_BYTES, n);
+
+    if(msg.msg_flags & MSG_TRUNC) {
+      udp_truncated();
+      continue;
+    }
+
+#ifndef DISCARDD
+    if(!ratelimit((struct sockaddr *)&from, 1, n, ratelimit_clock())) {
+      stat_inc(STAT_LIMITED);
+      continue;
+    }
+#endif
+
+    /* The datagrams queued before a flow was connected come here too,
+       they are answered on the shared socket. The flow is bound to the
+       address the peer used so that the answers come from it. */
+    fd = -1;
+    active = spawned - __atomic_load_n(&reaped, __ATOMIC_RELAXED);
+    if(active < config->flows && !flow_lookup((struct sockaddr *)&from)) {
+      memcpy(&local, &host_addr, sizeof(local));
+      flow_destination(&msg, &local);
+
+      fd = flow_open(&local, (struct sockaddr *)&from, msg.msg_namelen);
+      if(fd < 0)
+        evlog(EV_FLOW_FAILED, errno);
+    }
+
+#ifndef DISCARDD
+    if(fd < 0)
+      n = sendto(sd, buffer, n, 0, (struct sockaddr *)&from, msg.msg_namelen);
+    else
+      n = send(fd, buffer, n, 0);
+    if(n < 0)
+      sysstd_abort("send error");
+
+    stat_inc(STAT_TX_PACKETS);
+    stat_add(STAT_TX_BYTES, n);
+    stat_record(HIST_REPLY, received);
+#else
+    UNUSED(received);
+#endif
+
+    clear_buffer();
+
+    if(fd < 0)
+      continue;
+
+    flow_strays(fd);
+
+#ifdef __FreeBSD__
+    cap_rights_init(&rights, CAP_RECV, CAP_SEND, CAP_SETSOCKOPT);
+    xcap_rights_limit(fd, &rights);
+#endif
+
+    /* the flow is recorded before the child may be reaped */
+    sigprocmask(SIG_BLOCK, &chld, &saved);
+
+    pid = fork();
+    if(!pid) { /* child */
+      sigprocmask(SIG_SETMASK, &saved, NULL);
+      close(sd);
+      sandbox();
+
+      exit(serve_flow(fd, (struct sockaddr *)&from, config) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    else if(pid < 0) { /* error */
+      /* the peer falls back to the shared socket */
+      if(errno != EAGAIN)
+        sysstd_abort("fork error");
+      evlog(EV_FLOW_FAILED, errno);
+    }
+    else {
+      flow_add((struct sockaddr *)&from, pid);
+      spawned++;
+      stat_inc(STAT_ACCEPTED);
+    }
+
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+    close(fd);
+  }
+}
+
+static void server_udp(const struct srv_config *config)
+{
+#ifdef __FreeBSD__
+  cap_rights_t rights;
+  cap_rights_init(&rights, CAP_RECV, CAP_SEND, CAP_CONNECT);
+  xcap_rights_limit(sd, &rights);
+#endif
+
+  ratelimit_init(config->rate_packets, config->rate_bytes);
+
+  if(reflector)
+    twamp_socket(sd, af);
+
+  if(config->packet_if) {
+    buffer = alloc_buffers(buffer_size, 1, config->flags & SRV_HUGE_PAGES);
+    server_udp_packet(sd, (struct sockaddr *)&host_addr, config, udp_echo);
+    return;
+  }
+
+  /* Sandboxing does not work for the shared socket.
+     The sendto() call is rejected in capsicum capability mode.
+     But we cannot connect beforehand because we use a single
+     thread per UDP sockets. Flows are connected and sandboxed. */
+  if(config->flows) {
+    server_udp_flows(config);
+    return;
+  }
+
+  if(config->engine == ENGINE_URING) {
+    server_udp_uring(sd, config);
+    return;
+  }
+
+#ifdef UDP_GRO
+  if(config->flags & SRV_GRO) {
+    buffer = alloc_buffers(GRO_BUFFER_SIZE, 1, config->flags & SRV_HUGE_PAGES);
+    server_udp_gro();
+    return;
+  }
+#endif
+
+  buffer = alloc_buffers(buffer_size, config->batch, config->flags & SRV_HUGE_PAGES);
+
+#ifdef MSG_WAITFORONE
+  if(config->batch > 1) {
+    server_udp_batch(config->batch);
+    return;
+  }
+#endif
+
+  while(1)
+    udp_echo(0);
+}
+
+static void server_tcp(const struct srv_config *config)
+{
+  struct timeval timeout_tv = client_timeout(config);
+
+  listen_tcp(config);
+
+  /* The listeners wait until the socket is ready, another worker or
+     the daemon we hand it over to may accept the connection first. */
+  if(config->engine == ENGINE_FORK || config->engine == ENGINE_PREFORK) {
+    buffer = alloc_buffers(buffer_size, 1, config->flags & SRV_HUGE_PAGES);
+
+    if(fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK) < 0)
+      sysstd_abort("cannot set socket flags");
+  }
+
+  switch(config->engine) {
+  /* no child, everything happens in this process */
+  case ENGINE_EVENT:
+    sandbox();
+    server_tcp_event(sd, config);
+    return;
+  case ENGINE_URING:
+    sandbox();
+    server_tcp_uring(sd, config);
+    return;
+  case ENGINE_PREFORK:
+    server_tcp_prefork(config, &timeout_tv);
+    return;
+  default:
+    break;
+  }
+
+  setup_sig_chld();
+
+  while(1)
+    accept_fork(config, &timeout_tv);
+}
+
+/* Restore the state of the listener before it is served. */
+static void select_listener(const struct listen_socket *l)
+{
+  sd    = l->sd;
+  af    = l->af;
+  st    = l->st;
+  stats = l->stats;
+  evlog_current = l->evlog;
+  memcpy(&host_addr, &l->addr, sizeof(host_addr));
+}
+
+/* All the sockets are served from a single process that waits for any
+   of them to be ready. UDP datagrams are answered in this process while
+   each TCP client is served by its own child as with the fork engine. */
+static void server_single(const struct srv_config *config)
+{
+  struct timeval timeout_tv = client_timeout(config);
+  struct listen_socket **sockets;
+  struct listen_socket *l;
+  struct pollfd *fds;
+  unsigned int i;
+
+  setproctitle("listen on %u sockets", nb_listen_sockets);
+
+  sockets = xmalloc(nb_listen_sockets * sizeof(struct listen_socket *));
+  fds     = xmalloc(nb_listen_sockets * sizeof(struct pollfd));
+
+  for(l = listen_sockets, i = 0 ; l ; l = l->next, i++) {
+    char name[sizeof(((struct stats_listener *)0)->name)];
+
+    select_listener(l);
+
+    /* each socket has its own statistics */
+    listener_name(name, sizeof(name));
+    stats = NULL;
+    stats_attach(l->slot, name, 0);
+    evlog_attach(l->slot, name);
+    l->stats = stats;
+    l->evlog = evlog_current;
+
+    if(st == SOCK_STREAM)
+      listen_tcp(config);
+    else if(reflector)
+      twamp_socket(sd, af);
+
+    /* a ready socket may have nothing left to read */
+    if(fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK) < 0)
+      sysstd_abort("cannot set socket flags");
+
+    sockets[i] = l;
+    fds[i]     = (struct pollfd){ .fd = sd, .events = POLLIN };
+  }
+
+  buffer = alloc_buffers(buffer_size, 1, config->flags & SRV_HUGE_PAGES);
+  ratelimit_init(config->rate_packets, config->rate_bytes);
+
+  setup_sig_chld();
+
+  while(1) {
+    const sigset_t *mask = drain_block();
+    int n;
+
+    drain_check();
+    n = ppoll(fds, nb_listen_sockets, NULL, mask);
+    drain_unblock();
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      sysstd_abort("poll error");
+    }
+
+    for(i = 0 ; i < nb_listen_sockets ; i++) {
+      unsigned int budget = SINGLE_BUDGET;
+
+      if(!fds[i].revents)
+        continue;
+
+      select_listener(sockets[i]);
+
+      /* do not starve the other sockets */
+      if(st == SOCK_DGRAM)
+        while(budget-- && udp_echo(MSG_DONTWAIT));
+      else
+        while(budget-- && accept_fork(config, &timeout_tv));
+    }
+  }
+}
+
+void server(const struct srv_config *config)
+{
+  unsigned int index = worker;
+
+  /* Workers are spread over the nodes in turn and pinned
+     among the CPUs of their node. The buffers and the state of
+     the worker are allocated afterward on the same node. */
+  if(config->numa_node == NUMA_SPREAD) {
+    int node = nth_node(worker);
+
+    bind_node(node);
+    index = worker / node_count();
+    sysstd_log(LOG_INFO, "worker %u placed on NUMA node %d", worker, node);
+  }
+
+  if(config->flags & SRV_PIN_CPU) {
+    int cpu = pin_cpu(index);
+    sysstd_log(LOG_INFO, "worker %u pinned to CPU %d", worker, cpu);
+
+    if(config->flags & SRV_STEER_CPU)
+      incoming_cpu(sd, cpu);
+  }
+
+  buffer_size = config->buffer_size;
+  reflector   = config->flags & SRV_REFLECTOR;
+  burst       = config->flags & SRV_SOURCE ? config->burst : 0;
+  busy_poll_init(config->busy_poll);
+  zerocopy_init(config->zerocopy);
+  drain_init();
+
+  if(config->flags & SRV_SINGLE) {
+    server_single(config);
+    return;
+  }
+
   /* reflect address family and socket type in child name */
-  rename_listen_child();
+  rename_listen_child(config);
 
   switch(st) {
   case SOCK_DGRAM:
-    server_udp();
+    server_udp(config);
     break;
   case SOCK_STREAM:
-    server_tcp(max_clients, timeout);
+    server_tcp(config);
     break;
   default:
     assert(0); /* either UDP or TCP */
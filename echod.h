@@ -41,12 +41,97 @@ struct host {
   struct host *next;
 };
 
+/* Size of the receive buffers. The largest size is enough for
+   any UDP datagram and a reasonable TCP chunk. */
+#define DEFAULT_BUFFER_SIZE 4096
+#define MAX_BUFFER_SIZE     (1 << 20)
+
+/* Default length of the TCP listen queue. */
+#define DEFAULT_BACKLOG 4
+
+/* Pause before accepting again when out of descriptors or memory (ms). */
+#define ACCEPT_BACKOFF 10
+
+/* Maximum number of UDP datagrams handled per system call. */
+#define MAX_BATCH 1024
+
+/* Idle time before a UDP flow expires (s) and maximum number
+   of flows for each listener, each one is served by a child. */
+#define DEFAULT_FLOW_TIMEOUT 30
+#define MAX_FLOWS            1024
+
+/* NUMA placement of the workers other than a node number. */
+#define NUMA_NONE   -1
+#define NUMA_SPREAD -2
+
+/* Size of the receive buffer with UDP GRO,
+   enough for the largest coalesced datagram. */
+#define GRO_BUFFER_SIZE 65536
+
+/* FreeBSD only balances the load among
+   the sockets bound with SO_REUSEPORT_LB. */
+#ifdef SO_REUSEPORT_LB
+# define REUSEPORT SO_REUSEPORT_LB
+#else
+# define REUSEPORT SO_REUSEPORT
+#endif
+
+/* Clear the buffer after each request to avoid
+   any potential heartbleed vulnerability.
+   This expects buffer and buffer_size in the current scope. */
+#ifdef DO_CLEAR_BUFFER
+# define clear_buffer() memset(buffer, 0, buffer_size)
+#else
+# define clear_buffer() (void)0
+#endif /* DO_CLEAR_BUFFER */
+
 enum srv_flags {
-  SRV_DAEMON = 0x1,  /* detach from terminal */
-  SRV_INET   = 0x2,  /* listen only on IPv4 */
-  SRV_INET6  = 0x4,  /* listen only on IPv6 */
-  SRV_UDP    = 0x8,  /* listen on UDP */
-  SRV_TCP    = 0x10, /* listen on TCP */
+  SRV_DAEMON     = 0x1,    /* detach from terminal */
+  SRV_INET       = 0x2,    /* listen only on IPv4 */
+  SRV_INET6      = 0x4,    /* listen only on IPv6 */
+  SRV_UDP        = 0x8,    /* listen on UDP */
+  SRV_TCP        = 0x10,   /* listen on TCP */
+  SRV_PIN_CPU    = 0x20,   /* pin each worker to a CPU */
+  SRV_STREAM     = 0x40,   /* echo TCP streams until the end */
+  SRV_HUGE_PAGES = 0x80,   /* back buffers with huge pages */
+  SRV_GRO        = 0x100,  /* coalesce UDP datagrams (GRO/GSO) */
+  SRV_NODELAY    = 0x200,  /* disable Nagle algorithm on TCP clients */
+  SRV_QUICKACK   = 0x400,  /* acknowledge TCP requests right away */
+  SRV_SINGLE     = 0x800,  /* serve all the sockets from a single process */
+  SRV_DUAL_STACK = 0x1000, /* accept IPv4 on the IPv6 any address */
+  SRV_REFLECTOR  = 0x2000, /* answer TWAMP-light test packets */
+  SRV_SOURCE     = 0x4000, /* send data instead of answering */
+  SRV_STEER_CPU  = 0x8000, /* steer packets to the worker of their CPU */
+};
+
+/* Model used to serve TCP clients. */
+enum srv_engine {
+  ENGINE_FORK,    /* fork a new child for each connection */
+  ENGINE_PREFORK, /* fork a fixed pool of children at startup */
+  ENGINE_EVENT,   /* serve all connections from a single event loop */
+  ENGINE_URING,   /* serve UDP and TCP with io_uring */
+};
+
+struct srv_config {
+  unsigned long   flags;        /* see srv_flags */
+  enum srv_engine engine;       /* TCP engine */
+  unsigned int    max_clients;  /* maximum number of simultaneous TCP clients */
+  unsigned int    timeout;      /* TCP clients timeout (ms) */
+  unsigned int    batch;        /* UDP datagrams per system call */
+  unsigned int    workers;      /* listening processes per address */
+  size_t          buffer_size;  /* size of each receive buffer */
+  unsigned int    busy_poll;    /* spin budget before blocking (us) */
+  unsigned int    backlog;      /* TCP listen queue length */
+  unsigned int    fastopen;     /* TCP Fast Open queue length (0 to disable) */
+  unsigned int    defer_accept; /* accept TCP clients with data only (s) */
+  unsigned int    rate_packets; /* UDP packets per second per source */
+  unsigned long   rate_bytes;   /* UDP bytes per second per source */
+  unsigned int    flows;        /* UDP peers with their own socket (0 to disable) */
+  unsigned int    flow_timeout; /* idle time before a UDP flow expires (s) */
+  size_t          zerocopy;     /* smallest TCP answer sent without copy (0 to disable) */
+  unsigned int    burst;        /* UDP datagrams sent for each one received by the source */
+  const char     *packet_if;    /* interface of the UDP packet rings (NULL to disable) */
+  int             numa_node;    /* NUMA node of the workers, NUMA_NONE or NUMA_SPREAD */
 };
 
 /* Hosts list manipulation. */
@@ -54,11 +139,24 @@ struct host * add_host(struct host *hosts, const char *host, const char *port);
 void free_hosts(struct host *hosts);
 
 /* Bind host and port according to flags.
-   Each address binded is forked to a new child, in this case it returns 0.
-   The parent returns 1. */
-int bind_server(const struct host *hosts, unsigned long flags);
+   Each address binded is forked to a new child for each worker,
+   in this case it returns 0. The parent returns 1. In the single
+   process mode a single child is forked for all the addresses. */
+int bind_server(const struct host *hosts, const struct srv_config *config);
+
+/* Same as bind_server() with sockets already bound, either handed over
+   by a running daemon or passed by the service manager. Each socket
+   is served by a single listener. */
+int inherit_server(const int *fds, unsigned int nb_fds, const struct srv_config *config);
+
+/* Sockets of the master, to hand them over. */
+int * server_sockets(unsigned int *nb);
+
+/* Let the listeners finish their work and exit, then terminate
+   those still running after timeout seconds. */
+void drain_server(unsigned int timeout);
 
 /* Listen on the socket created for this specific child. */
-void server(unsigned int max_clients, unsigned int timeout);
+void server(const struct srv_config *config);
 
 #endif /* _ECHOD_H_ */
@@ -0,0 +1,463 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include <gawen/common.h>
+#include <gawen/log.h>
+
+#include "event.h"
+#include "buffer.h"
+#include "stats.h"
+#include "busy.h"
+#include "tcp.h"
+#include "handoff.h"
+#include "evlog.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include <gawen/safe-call.h>
+
+#define MAX_EVENTS 64
+
+/* A connection waiting for its request or for its answer to be sent.
+   All connections share the same timeout so they are queued in the
+   order of their last activity, which is also the order of their deadline. */
+struct conn {
+  int fd;
+
+  unsigned char *pending; /* answer not sent yet */
+  size_t         len;
+  size_t         off;
+
+  uint64_t deadline; /* ms */
+  uint64_t accepted; /* latency timestamps */
+  uint64_t received;
+
+  struct conn *prev;
+  struct conn *next;
+};
+
+static struct conn *head; /* earliest deadline */
+static struct conn *tail; /* latest deadline */
+
+static unsigned int clients; /* number of clients connected */
+
+/* The listening socket stays readable when we cannot accept,
+   it is left out of the epoll set until this deadline (ms) or
+   until a connection is released. */
+static int      accept_paused;
+static uint64_t accept_resume;
+
+static unsigned char *buffer;
+static size_t         buffer_size;
+
+static uint64_t now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void enqueue(struct conn *c)
+{
+  c->prev = tail;
+  c->next = NULL;
+
+  if(tail)
+    tail->next = c;
+  else
+    head = c;
+  tail = c;
+}
+
+static void dequeue(struct conn *c)
+{
+  if(c->prev)
+    c->prev->next = c->next;
+  else
+    head = c->next;
+
+  if(c->next)
+    c->next->prev = c->prev;
+  else
+    tail = c->prev;
+}
+
+/* Push back the deadline of a connection after some activity. */
+static void touch_conn(struct conn *c, const struct srv_config *config)
+{
+  dequeue(c);
+  c->deadline = now_ms() + config->timeout;
+  enqueue(c);
+}
+
+static void close_conn(struct conn *c)
+{
+  /* closing the descriptor also removes it from the epoll set */
+  close(c->fd);
+  dequeue(c);
+  free(c->pending);
+  free(c);
+  clients--;
+
+  accept_resume = 0;
+}
+
+static void pause_accept(int ep, int sd)
+{
+  struct epoll_event ev = { .events = 0, .data.ptr = NULL };
+
+  if(epoll_ctl(ep, EPOLL_CTL_MOD, sd, &ev) < 0)
+    sysstd_abort("cannot modify listening socket events");
+
+  accept_paused = 1;
+  accept_resume = now_ms() + ACCEPT_BACKOFF;
+}
+
+static void resume_accept(int ep, int sd)
+{
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+  if(epoll_ctl(ep, EPOLL_CTL_MOD, sd, &ev) < 0)
+    sysstd_abort("cannot modify listening socket events");
+
+  accept_paused = 0;
+}
+
+static void accept_conns(int ep, int sd, const struct srv_config *config)
+{
+  while(1) {
+    struct epoll_event ev;
+    struct conn *c;
+    int fd;
+
+    fd = accept4(sd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd < 0) {
+      switch(errno) {
+      case EAGAIN:
+        return;
+      case EINTR:
+      case ECONNABORTED:
+        continue;
+      case EMFILE:
+      case ENFILE:
+      case ENOBUFS:
+      case ENOMEM:
+        /* retry when a connection is released or after a pause */
+        evlog(EV_ACCEPT_ERROR, errno);
+        pause_accept(ep, sd);
+        return;
+      default:
+        sysstd_abort("accept error");
+      }
+    }
+
+    if(config->max_clients && clients >= config->max_clients) {
+      close(fd);
+      stat_inc(STAT_DROPPED);
+      evlog(EV_DROPPED, 0);
+      continue;
+    }
+
+    c  = xmalloc(sizeof(struct conn));
+    *c = (struct conn){ .fd       = fd,
+                        .deadline = now_ms() + config->timeout,
+                        .accepted = stat_clock() };
+
+    ev = (struct epoll_event){ .events = EPOLLIN,
+                               .data.ptr = c };
+    if(epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0)
+      sysstd_abort("cannot register connection");
+
+    enqueue(c);
+    clients++;
+    stat_inc(STAT_ACCEPTED);
+
+    tcp_quickack(fd, config);
+  }
+}
+
+#ifndef DISCARDD
+/* Send the pending answer. Return 1 when the connection is done. */
+static int send_pending(int ep, struct conn *c, const struct srv_config *config)
+{
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+
+  while(c->off < c->len) {
+    ssize_t n = send(c->fd, c->pending + c->off, c->len - c->off, MSG_NOSIGNAL);
+    if(n < 0) {
+      switch(errno) {
+      case EINTR:
+        continue;
+      case EAGAIN:
+        return 0;
+      default:
+        stat_inc(STAT_TX_ERRORS);
+        evlog(EV_SEND_ERROR, errno);
+        return 1;
+      }
+    }
+    c->off += n;
+    stat_add(STAT_TX_BYTES, n);
+  }
+  stat_inc(STAT_TX_PACKETS);
+  stat_record(HIST_REPLY, c->received);
+
+  if(!(config->flags & SRV_STREAM))
+    return 1;
+
+  /* wait for more data from the client */
+  free(c->pending);
+  c->pending = NULL;
+  c->off     = 0;
+
+  if(epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+    sysstd_abort("cannot modify connection events");
+
+  touch_conn(c, config);
+
+  return 0;
+}
+#endif /* DISCARDD */
+
+#ifndef DISCARDD
+/* Answer the n bytes received in the buffer. Return 1 when the
+   answer was sent, 0 when some of it is pending and -1 on error. */
+static int answer(int ep, struct conn *c, size_t n)
+{
+  struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = c };
+  ssize_t s;
+
+  s = send(c->fd, buffer, n, MSG_NOSIGNAL);
+  if(s < 0) {
+    if(errno != EAGAIN) {
+      stat_inc(STAT_TX_ERRORS);
+      evlog(EV_SEND_ERROR, errno);
+      return -1;
+    }
+    s = 0;
+  }
+  stat_add(STAT_TX_BYTES, s);
+
+  if((size_t)s == n) {
+    stat_inc(STAT_TX_PACKETS);
+    stat_record(HIST_REPLY, c->received);
+    return 1;
+  }
+
+  /* The socket buffer is full, keep the remaining
+     of the answer until the socket is writable. */
+  c->len     = n - s;
+  c->pending = xmalloc(c->len);
+  memcpy(c->pending, buffer + s, c->len);
+
+  if(epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+    sysstd_abort("cannot modify connection events");
+
+  return 0;
+}
+#endif /* DISCARDD */
+
+/* Receive the request and answer it.
+   Return 1 when the connection is done. */
+static int recv_request(int ep, struct conn *c, const struct srv_config *config)
+{
+  ssize_t n;
+
+INTR: /* syscall may be interrupted */
+  n = recv(c->fd, buffer, buffer_size, 0);
+  if(n < 0) {
+    switch(errno) {
+    case EINTR:
+      goto INTR;
+    case EAGAIN:
+      return 0;
+    default:
+      stat_inc(STAT_RX_ERRORS);
+      evlog(EV_RECV_ERROR, errno);
+      return 1;
+    }
+  }
+
+  /* end of stream */
+  if(n == 0)
+    return 1;
+  c->received = stat_request(&c->accepted);
+
+  stat_inc(STAT_RX_PACKETS);
+  stat_add(STAT_RX_BYTES, n);
+
+#ifndef DISCARDD
+  n = answer(ep, c, n);
+  clear_buffer();
+
+  if(n < 0) /* error */
+    return 1;
+  else if(n == 0) /* answer pending */
+    return 0;
+#else
+  UNUSED(ep);
+  clear_buffer();
+#endif /* DISCARDD */
+
+  /* In stream mode we answer until the client closes the connection. */
+  if(config->flags & SRV_STREAM) {
+    tcp_quickack(c->fd, config);
+    touch_conn(c, config);
+    return 0;
+  }
+
+  /* We answered the client.
+     Now we can close. */
+  return 1;
+}
+
+/* Close the connections which expired and return the
+   time in ms until the next deadline (-1 if none). */
+static int expire_conns(const struct srv_config *config)
+{
+  uint64_t now;
+
+  if(!config->timeout)
+    return -1;
+
+  now = now_ms();
+  while(head && head->deadline <= now) {
+    evlog(EV_TIMEOUT, 0);
+    stat_inc(STAT_TIMEOUTS);
+    close_conn(head);
+  }
+
+  return head ? (int)(head->deadline - now) : -1;
+}
+
+void server_tcp_event(int sd, const struct srv_config *config)
+{
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+  int ep;
+
+  buffer_size = config->buffer_size;
+  buffer      = alloc_buffers(buffer_size, 1, config->flags & SRV_HUGE_PAGES);
+
+  ep = epoll_create1(EPOLL_CLOEXEC);
+  if(ep < 0)
+    sysstd_abort("cannot create epoll instance");
+
+  if(fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK) < 0)
+    sysstd_abort("cannot switch listening socket to non-blocking mode");
+
+  if(epoll_ctl(ep, EPOLL_CTL_ADD, sd, &ev) < 0)
+    sysstd_abort("cannot register listening socket");
+
+  while(1) {
+    struct epoll_event events[MAX_EVENTS];
+    int i, n, wait_ms;
+
+    /* stop accepting and serve the connections left */
+    if(draining && sd >= 0) {
+      epoll_ctl(ep, EPOLL_CTL_DEL, sd, NULL);
+      sd = -1;
+    }
+    if(sd < 0 && !clients)
+      drain_exit();
+
+    wait_ms = expire_conns(config);
+
+    if(accept_paused && sd >= 0) {
+      uint64_t now = now_ms();
+
+      if(now >= accept_resume)
+        resume_accept(ep, sd);
+      else if(wait_ms < 0 || accept_resume - now < (uint64_t)wait_ms)
+        wait_ms = accept_resume - now;
+    }
+
+    n = 0;
+    if(busy_budget) {
+      uint64_t deadline = busy_deadline();
+
+      /* the timeouts are checked once the spin is over */
+      do
+        n = epoll_wait(ep, events, MAX_EVENTS, 0);
+      while(!n && busy_spinning(deadline));
+    }
+    if(!n) {
+      const sigset_t *mask = drain_block();
+
+      /* a drain not seen above is handled before we sleep */
+      if(!draining || sd < 0)
+        n = epoll_pwait(ep, events, MAX_EVENTS, wait_ms, mask);
+      drain_unblock();
+    }
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      sysstd_abort("epoll error");
+    }
+
+    for(i = 0 ; i < n ; i++) {
+      struct conn *c = events[i].data.ptr;
+      int done;
+
+      if(!c) { /* listening socket */
+        accept_conns(ep, sd, config);
+        continue;
+      }
+
+#ifndef DISCARDD
+      if(c->pending)
+        done = send_pending(ep, c, config);
+      else
+#endif /* DISCARDD */
+        done = recv_request(ep, c, config);
+
+      if(done)
+        close_conn(c);
+    }
+  }
+}
+
+#else /* !__linux__ */
+
+void server_tcp_event(int sd, const struct srv_config *config)
+{
+  UNUSED(sd);
+  UNUSED(config);
+
+  sysstd_abortx("event engine not supported on this platform");
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,99 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <syslog.h>
+
+#include <gawen/log.h>
+
+#include "stats.h"
+#include "evlog.h"
+
+/* One slot for each listener, as the statistics. */
+#define EVLOG_SIZE (STATS_MAX_LISTENERS * sizeof(struct evlog_listener))
+
+struct evlog_listener *evlog_current;
+
+static struct evlog_listener *listeners;
+static uint64_t logged[STATS_MAX_LISTENERS][EV_MAX]; /* master only */
+
+static const struct {
+  int priority;
+  const char *message;
+} events[EV_MAX] = {
+  [EV_DROPPED]      = { LOG_DEBUG,   "connection dropped: maximum number of clients reached" },
+  [EV_FORK_FAILED]  = { LOG_WARNING, "connection dropped: cannot fork" },
+  [EV_ACCEPT_ERROR] = { LOG_WARNING, "cannot accept connection" },
+  [EV_TIMEOUT]      = { LOG_DEBUG,   "connection timeout" },
+  [EV_TRUNCATED]    = { LOG_DEBUG,   "datagram truncated: larger than the buffer size" },
+  [EV_RECV_ERROR]   = { LOG_ERR,     "receive error" },
+  [EV_SEND_ERROR]   = { LOG_ERR,     "send error" },
+  [EV_FLOW_FAILED]  = { LOG_WARNING, "cannot open UDP flow" },
+  [EV_ZEROCOPY]     = { LOG_WARNING, "zero copy answer not released in time" }
+};
+
+void evlog_init(void)
+{
+  listeners = mmap(NULL, EVLOG_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(listeners == MAP_FAILED)
+    sysstd_abort("cannot map shared events");
+}
+
+void evlog_attach(unsigned int slot, const char *name)
+{
+  if(slot >= STATS_MAX_LISTENERS) {
+    evlog_current = NULL;
+    return;
+  }
+
+  evlog_current = &listeners[slot];
+  strncpy(evlog_current->name, name, sizeof(evlog_current->name) - 1);
+}
+
+void evlog_flush(void)
+{
+  unsigned int i, j;
+
+  for(i = 0 ; i < STATS_MAX_LISTENERS ; i++) {
+    const struct evlog_listener *l = &listeners[i];
+
+    for(j = 0 ; j < EV_MAX ; j++) {
+      uint64_t n = __atomic_load_n(&l->events[j], __ATOMIC_RELAXED) - logged[i][j];
+      int err    = __atomic_load_n(&l->last_errno[j], __ATOMIC_RELAXED);
+
+      if(!n)
+        continue;
+      logged[i][j] += n;
+
+      if(err)
+        sysstd_log(events[j].priority, "%s: %s: %s (%llu times in %ds)", l->name,
+                   events[j].message, strerror(err), (unsigned long long)n, EVLOG_INTERVAL);
+      else
+        sysstd_log(events[j].priority, "%s: %s (%llu times in %ds)", l->name,
+                   events[j].message, (unsigned long long)n, EVLOG_INTERVAL);
+    }
+  }
+}
@@ -0,0 +1,81 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _EVLOG_H_
+#define _EVLOG_H_
+
+#include <stdint.h>
+
+/* Events which may happen on each request are not logged as they happen.
+   Each listener counts them in memory shared with the master which logs
+   a summary of the events of each listener every second. The cost of an
+   event is an atomic increment and the number of messages is bounded
+   whatever the rate of the events. */
+
+/* Period of the summaries (s). */
+#define EVLOG_INTERVAL 1
+
+enum log_event {
+  EV_DROPPED,      /* maximum number of clients reached */
+  EV_FORK_FAILED,
+  EV_ACCEPT_ERROR,
+  EV_TIMEOUT,
+  EV_TRUNCATED,
+  EV_RECV_ERROR,
+  EV_SEND_ERROR,
+  EV_FLOW_FAILED,  /* peer answered from the shared socket */
+  EV_ZEROCOPY,     /* buffer not released in time */
+  EV_MAX
+};
+
+struct evlog_listener {
+  char     name[64];
+  uint64_t events[EV_MAX];
+  int      last_errno[EV_MAX]; /* for the errors */
+} __attribute__((aligned(64)));
+
+/* Slot of the calling listener (NULL when not attached). */
+extern struct evlog_listener *evlog_current;
+
+/* Map the shared events, before the listeners are forked. */
+void evlog_init(void);
+
+/* Use the specified slot for the calling listener. */
+void evlog_attach(unsigned int slot, const char *name);
+
+/* Log a summary of the events since the last call (master). */
+void evlog_flush(void);
+
+/* Count an event, err is the errno of the errors. */
+static inline void evlog(enum log_event event, int err)
+{
+  if(!evlog_current)
+    return;
+
+  __atomic_fetch_add(&evlog_current->events[event], 1, __ATOMIC_RELAXED);
+  if(err)
+    __atomic_store_n(&evlog_current->last_errno[event], err, __ATOMIC_RELAXED);
+}
+
+#endif /* _EVLOG_H_ */
@@ -0,0 +1,191 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+
+#include <gawen/common.h>
+#include <gawen/log.h>
+#include <gawen/safe-call.h>
+
+#include "echod.h"
+#include "flow.h"
+
+/* Peers with a flow, the pid is zero for free entries.
+   Only the listener searches the table which is small,
+   it does so for the datagrams of the shared socket. */
+struct flow {
+  volatile pid_t pid;
+  struct sockaddr_storage peer;
+};
+
+static struct flow  *flows;
+static unsigned int  nb_flows;
+
+static int same_peer(const struct sockaddr *a, const struct sockaddr *b)
+{
+  const struct sockaddr_in  *a4 = (const struct sockaddr_in *)a,  *b4 = (const struct sockaddr_in *)b;
+  const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)a, *b6 = (const struct sockaddr_in6 *)b;
+
+  if(a->sa_family != b->sa_family)
+    return 0;
+
+  if(a->sa_family == AF_INET)
+    return a4->sin_port == b4->sin_port &&
+           a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+  return a6->sin6_port == b6->sin6_port &&
+         !memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr));
+}
+
+void flow_init(unsigned int max)
+{
+  flows    = xcalloc(max, sizeof(struct flow));
+  nb_flows = max;
+}
+
+int flow_lookup(const struct sockaddr *peer)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < nb_flows ; i++)
+    if(flows[i].pid && same_peer((struct sockaddr *)&flows[i].peer, peer))
+      return 1;
+  return 0;
+}
+
+void flow_add(const struct sockaddr *peer, pid_t pid)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < nb_flows ; i++) {
+    if(!flows[i].pid) {
+      memcpy(&flows[i].peer, peer, peer->sa_family == AF_INET ? sizeof(struct sockaddr_in)
+                                                              : sizeof(struct sockaddr_in6));
+      flows[i].pid = pid;
+      return;
+    }
+  }
+
+  assert(0); /* the caller checks the number of flows */
+}
+
+void flow_exited(pid_t pid)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < nb_flows ; i++) {
+    if(flows[i].pid == pid) {
+      flows[i].pid = 0;
+      return;
+    }
+  }
+}
+
+void flow_recv_destination(int sd, int af)
+{
+  int optval = 1;
+  int n = 0;
+
+  switch(af) {
+  case AF_INET:
+#if defined(IP_PKTINFO)
+    n = setsockopt(sd, IPPROTO_IP, IP_PKTINFO, &optval, sizeof(optval));
+#elif defined(IP_RECVDSTADDR)
+    n = setsockopt(sd, IPPROTO_IP, IP_RECVDSTADDR, &optval, sizeof(optval));
+#endif
+    break;
+  case AF_INET6:
+    n = setsockopt(sd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &optval, sizeof(optval));
+    break;
+  }
+
+  if(n < 0)
+    sysstd_abort("cannot receive destination address");
+}
+
+void flow_destination(struct msghdr *msg, struct sockaddr_storage *local)
+{
+  struct cmsghdr *cmsg;
+
+  for(cmsg = CMSG_FIRSTHDR(msg) ; cmsg ; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+#if defined(IP_PKTINFO)
+    if(cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+      const struct in_pktinfo *info = (const struct in_pktinfo *)CMSG_DATA(cmsg);
+      ((struct sockaddr_in *)local)->sin_addr = info->ipi_addr;
+    }
+#elif defined(IP_RECVDSTADDR)
+    if(cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVDSTADDR)
+      memcpy(&((struct sockaddr_in *)local)->sin_addr, CMSG_DATA(cmsg), sizeof(struct in_addr));
+#endif
+    if(cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+      const struct in6_pktinfo *info = (const struct in6_pktinfo *)CMSG_DATA(cmsg);
+      ((struct sockaddr_in6 *)local)->sin6_addr = info->ipi6_addr;
+    }
+  }
+}
+
+int flow_open(const struct sockaddr_storage *local,
+              const struct sockaddr *peer, socklen_t peer_len)
+{
+  int af = local->ss_family;
+  int optval = 1;
+  int fd, n;
+
+  fd = socket(af, SOCK_DGRAM, 0);
+  if(fd < 0)
+    return -1;
+
+  /* share the port with the listening socket */
+  n = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+#ifdef SO_REUSEPORT
+  if(!n)
+    n = setsockopt(fd, SOL_SOCKET, REUSEPORT, &optval, sizeof(optval));
+#endif
+
+  /* IPv4 peers of a dual-stack socket are IPv4-mapped */
+  if(!n && af == AF_INET6) {
+    optval = !IN6_IS_ADDR_V4MAPPED(&((const struct sockaddr_in6 *)peer)->sin6_addr);
+    n = setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &optval, sizeof(optval));
+  }
+
+  if(!n)
+    n = bind(fd, (const struct sockaddr *)local, af == AF_INET ? sizeof(struct sockaddr_in)
+                                                               : sizeof(struct sockaddr_in6));
+  if(!n)
+    n = connect(fd, peer, peer_len);
+
+  if(n < 0) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+
+  return fd;
+}
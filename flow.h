@@ -0,0 +1,69 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _FLOW_H_
+#define _FLOW_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* A flow is a UDP socket bound to the listening address and connected
+   to a single peer. The kernel delivers the datagrams of this peer to
+   the flow instead of the shared socket and the answers are sent with
+   send(), so that the flow can be served from a sandboxed child. The
+   listener keeps track of the peers with a flow to avoid opening a
+   second one for the datagrams queued before the first was connected. */
+
+/* Room for the destination address of a datagram. */
+union flow_control {
+  char buf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+  struct cmsghdr align;
+};
+
+/* Allocate the table of the flows of this listener. */
+void flow_init(unsigned int max);
+
+/* Whether the peer already has a flow. */
+int flow_lookup(const struct sockaddr *peer);
+
+/* Record the child serving the flow of a peer. The caller ensures
+   that there is room left and that SIGCHLD is blocked. */
+void flow_add(const struct sockaddr *peer, pid_t pid);
+
+/* Forget the flow of an exited child (signal handler). */
+void flow_exited(pid_t pid);
+
+/* Report the destination address of each datagram received on sd. */
+void flow_recv_destination(int sd, int af);
+
+/* Set the address of local to the destination of the datagram
+   if it is available, the port is left unchanged. */
+void flow_destination(struct msghdr *msg, struct sockaddr_storage *local);
+
+/* Open a flow from local to peer. Return -1 on error. */
+int flow_open(const struct sockaddr_storage *local,
+              const struct sockaddr *peer, socklen_t peer_len);
+
+#endif /* _FLOW_H_ */
@@ -0,0 +1,297 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <gawen/common.h>
+#include <gawen/log.h>
+
+#include "handoff.h"
+#include "evlog.h"
+
+/* First descriptor passed by the service manager. */
+#define LISTEN_FDS_START 3
+
+/* Time to wait for the new daemon to start its listeners (s). */
+#define HANDOFF_TIMEOUT 10
+
+volatile sig_atomic_t draining;
+
+static int takeover = -1; /* connection to the previous daemon */
+
+static void sig_drain(int signum)
+{
+  UNUSED(signum);
+  draining = 1;
+}
+
+void drain_init(void)
+{
+  struct sigaction act = { .sa_handler = sig_drain, .sa_flags = 0 };
+
+  sigemptyset(&act.sa_mask);
+  sigaction(SIGUSR2, &act, NULL);
+}
+
+void drain_exit(void)
+{
+  sysstd_log(LOG_INFO, "listener drained");
+  exit(EXIT_SUCCESS);
+}
+
+const sigset_t * drain_block(void)
+{
+  static sigset_t mask;
+  sigset_t set;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR2);
+  sigprocmask(SIG_BLOCK, &set, &mask);
+  sigdelset(&mask, SIGUSR2);
+
+  return &mask;
+}
+
+void drain_unblock(void)
+{
+  sigset_t set;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR2);
+  sigprocmask(SIG_UNBLOCK, &set, NULL);
+}
+
+void drain_wait(int fd)
+{
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  const sigset_t *mask = drain_block();
+
+  drain_check();
+  if(ppoll(&pfd, 1, NULL, mask) < 0 && errno != EINTR)
+    sysstd_abort("poll error");
+  drain_unblock();
+}
+
+unsigned int listen_fds(int *fds, unsigned int max)
+{
+  const char *pid = getenv("LISTEN_PID");
+  const char *nb  = getenv("LISTEN_FDS");
+  unsigned int i, n;
+
+  if(!pid || !nb || atoi(pid) != getpid())
+    return 0;
+
+  n = atoi(nb);
+  if(n > max)
+    sysstd_abortx("too many sockets passed (%u)", n);
+
+  for(i = 0 ; i < n ; i++)
+    fds[i] = LISTEN_FDS_START + i;
+
+  /* not for our children */
+  unsetenv("LISTEN_PID");
+  unsetenv("LISTEN_FDS");
+  unsetenv("LISTEN_FDNAMES");
+
+  return n;
+}
+
+static void unix_addr(const char *path, struct sockaddr_un *addr)
+{
+  if(strlen(path) >= sizeof(addr->sun_path))
+    sysstd_abortx("handoff socket path too long");
+
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path);
+}
+
+unsigned int handoff_receive(const char *path, int *fds, unsigned int max)
+{
+  struct sockaddr_un addr;
+  union {
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } cmsg_buf;
+  uint32_t nb_fds;
+  struct iovec  iov = { .iov_base = &nb_fds, .iov_len = sizeof(nb_fds) };
+  struct msghdr msg = { .msg_iov        = &iov,
+                        .msg_iovlen     = 1,
+                        .msg_control    = cmsg_buf.control,
+                        .msg_controllen = sizeof(cmsg_buf.control) };
+  struct cmsghdr *cmsg;
+  unsigned int n = 0;
+
+  unix_addr(path, &addr);
+
+  takeover = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(takeover < 0)
+    sysstd_abort("cannot create handoff socket");
+
+  /* nobody to take over from */
+  if(connect(takeover, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    if(errno != ENOENT && errno != ECONNREFUSED)
+      sysstd_abort("cannot connect to running daemon");
+    close(takeover);
+    takeover = -1;
+    return 0;
+  }
+
+  if(recvmsg(takeover, &msg, MSG_WAITALL) != sizeof(nb_fds))
+    sysstd_abortx("cannot receive sockets from running daemon");
+  if(msg.msg_flags & MSG_CTRUNC)
+    sysstd_abortx("too many sockets from running daemon");
+
+  for(cmsg = CMSG_FIRSTHDR(&msg) ; cmsg ; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      if(n > max)
+        sysstd_abortx("too many sockets from running daemon");
+      memcpy(fds, CMSG_DATA(cmsg), n * sizeof(int));
+    }
+
+  if(n != nb_fds)
+    sysstd_abortx("sockets missing from running daemon");
+
+  sysstd_log(LOG_NOTICE, "took %u sockets over from running daemon", n);
+
+  return n;
+}
+
+void handoff_ack(void)
+{
+  char ack = 1;
+
+  if(takeover < 0)
+    return;
+
+  if(write(takeover, &ack, sizeof(ack)) < 0)
+    sysstd_warn(LOG_WARNING, "cannot notify running daemon");
+
+  close(takeover);
+  takeover = -1;
+}
+
+int handoff_listen(const char *path)
+{
+  struct sockaddr_un addr;
+  int usd;
+
+  unix_addr(path, &addr);
+
+  usd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(usd < 0)
+    sysstd_abort("cannot create handoff socket");
+
+  /* the previous daemon no longer listens */
+  unlink(path);
+  if(bind(usd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    sysstd_abort("cannot bind handoff socket");
+  if(listen(usd, 1) < 0)
+    sysstd_abort("cannot listen on handoff socket");
+
+  return usd;
+}
+
+/* Send the sockets and wait until the new listeners are running. */
+static int handoff_send(int fd, const int *fds, unsigned int nb_fds)
+{
+  union {
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } cmsg_buf;
+  uint32_t n = nb_fds;
+  struct iovec  iov = { .iov_base = &n, .iov_len = sizeof(n) };
+  struct msghdr msg = { .msg_iov        = &iov,
+                        .msg_iovlen     = 1,
+                        .msg_control    = cmsg_buf.control,
+                        .msg_controllen = CMSG_SPACE(nb_fds * sizeof(int)) };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  struct timeval timeout = { .tv_sec = HANDOFF_TIMEOUT };
+  char ack;
+
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(nb_fds * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, nb_fds * sizeof(int));
+
+  if(sendmsg(fd, &msg, 0) != sizeof(n)) {
+    sysstd_warn(LOG_WARNING, "cannot hand sockets over");
+    return 0;
+  }
+
+  /* the new daemon may fail before its listeners start */
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if(read(fd, &ack, sizeof(ack)) != sizeof(ack)) {
+    sysstd_log(LOG_WARNING, "new daemon did not start, keep serving");
+    return 0;
+  }
+
+  return 1;
+}
+
+int handoff_wait(int usd, const int *fds, unsigned int nb_fds)
+{
+  struct pollfd pfd = { .fd = usd, .events = POLLIN };
+
+  if(nb_fds > HANDOFF_MAX_FDS)
+    sysstd_log(LOG_WARNING, "too many sockets to hand over (%u)", nb_fds);
+
+  while(1) {
+    int n = poll(&pfd, 1, EVLOG_INTERVAL * 1000);
+
+    if(n < 0 && errno != EINTR)
+      sysstd_abort("poll error");
+
+    if(n > 0) {
+      int fd = accept(usd, NULL, NULL);
+
+      if(fd >= 0) {
+        n = nb_fds <= HANDOFF_MAX_FDS && handoff_send(fd, fds, nb_fds);
+        close(fd);
+
+        if(n) {
+          close(usd);
+          return 1;
+        }
+      }
+    }
+
+    evlog_flush();
+
+    /* SIGCHLD is ignored, this fails once all the listeners exited */
+    if(waitpid(-1, NULL, WNOHANG) < 0 && errno == ECHILD)
+      return 0;
+  }
+}
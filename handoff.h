@@ -0,0 +1,81 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _HANDOFF_H_
+#define _HANDOFF_H_
+
+#include <signal.h>
+
+/* A running daemon hands its sockets over to a new one through a Unix
+   socket with SCM_RIGHTS. Both share the same sockets so no datagram
+   or connection is lost while the old listeners drain and exit. */
+
+/* Largest number of sockets handed over (SCM_MAX_FD on Linux). */
+#define HANDOFF_MAX_FDS 253
+
+/* Time left to the old listeners to drain (s). */
+#define DRAIN_TIMEOUT 30
+
+/* Set in the listeners once they should drain. */
+extern volatile sig_atomic_t draining;
+
+/* Drain on SIGUSR2. Blocking calls are interrupted so each
+   listener checks the flag whenever it is about to wait. */
+void drain_init(void);
+void drain_exit(void);
+
+static inline void drain_check(void)
+{
+  if(draining)
+    drain_exit();
+}
+
+/* The signal may still arrive between the check and the wait. So the
+   listeners block it before they check the flag and sleep with the
+   returned mask which lets it in (ppoll(), epoll_pwait(), ...). */
+const sigset_t * drain_block(void);
+void drain_unblock(void);
+
+/* Wait until the descriptor is readable or the listener drains.
+   The calls on the descriptor itself should not block. */
+void drain_wait(int fd);
+
+/* Sockets passed by the service manager (LISTEN_FDS),
+   return the number of sockets stored in fds. */
+unsigned int listen_fds(int *fds, unsigned int max);
+
+/* Take the sockets over from the daemon listening on path. Return the
+   number of sockets stored in fds, zero when no daemon is running. */
+unsigned int handoff_receive(const char *path, int *fds, unsigned int max);
+
+/* Tell the previous daemon that our listeners are running. */
+void handoff_ack(void);
+
+/* Wait for a new daemon on path. Return 1 once the sockets have
+   been handed over and 0 when all the listeners have exited.
+   The events of the listeners are logged meanwhile. */
+int handoff_listen(const char *path);
+int handoff_wait(int usd, const int *fds, unsigned int nb_fds);
+
+#endif /* _HANDOFF_H_ */
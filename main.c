@@ -22,6 +22,9 @@
    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/socket.h>
+#include <netinet/udp.h>
+#include <netinet/tcp.h>
 #include <sys/wait.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -41,6 +44,12 @@
 
 #include "version.h"
 #include "echod.h"
+#include "stats.h"
+#include "handoff.h"
+#include "evlog.h"
+#include "twamp.h"
+#include "source.h"
+#include "affinity.h"
 
 static void sig_quit(int signum)
 {
@@ -91,6 +100,36 @@ static void print_help(const char *name)
     { 'l', "log-level",   "Syslog level from 1 to 8 (default: 7)" },
     { 'c', "max-clients", "Maximum number of simultaneous TCP clients (default: 64)" },
     { 'T', "timeout",     "Timeout for TCP clients (default: 100ms)" },
+    { 'e', "engine",      "Engine, either fork, prefork, event or uring (default: fork)" },
+    { 's', "stream",      "Answer TCP clients until they close the connection" },
+    { 'b', "batch",       "UDP datagrams handled per system call (default: 1)" },
+    { 'B', "buffer-size", "Size of each receive buffer (default: 4096)" },
+    { 'H', "huge-pages",  "Back the receive buffers with huge pages" },
+    { 'G', "gro",         "Coalesce UDP datagrams on receive and send (GRO/GSO)" },
+    { 'w', "workers",     "Listening processes per address (default: 1)" },
+    { 'P', "pin-cpu",     "Pin each worker to a different CPU" },
+    { 0,   "steer-cpu",   "Steer packets to the worker pinned to their CPU" },
+    { 0,   "numa",        "Place the workers on a NUMA node, interface or spread" },
+    { 0,   "single",      "Serve all the addresses from a single process" },
+    { 0,   "dual-stack",  "Accept IPv4 on the IPv6 any address" },
+    { 0,   "rate-limit",  "UDP datagrams answered per second per source" },
+    { 0,   "rate-limit-bytes", "UDP bytes answered per second per source" },
+    { 0,   "flows",       "UDP peers served on their own connected socket" },
+    { 0,   "flow-timeout", "Idle time before a UDP flow expires (default: 30s)" },
+    { 0,   "reflector",   "Answer TWAMP-light test packets with timestamps" },
+    { 0,   "source",      "Send data to the clients instead of answering" },
+    { 0,   "burst",       "UDP datagrams sent for each one received (default: 1)" },
+    { 0,   "packet",      "Answer UDP from packet rings on this interface" },
+    { 0,   "busy-poll",   "Spin for this many us before blocking on receive" },
+    { 0,   "backlog",     "Length of the TCP listen queue (default: 4)" },
+    { 0,   "fastopen",    "Accept TCP Fast Open with this queue length" },
+    { 0,   "defer-accept", "Accept TCP clients only once they sent data" },
+    { 0,   "nodelay",     "Disable Nagle's algorithm on TCP answers" },
+    { 0,   "quickack",    "Acknowledge TCP requests without delay" },
+    { 0,   "zerocopy",    "Send TCP answers of at least this size without copy" },
+    { 0,   "handoff",     "Unix socket to hand the sockets over on upgrade" },
+    { 'S', "stats",       "Maintain live statistics in file" },
+    { 'L', "latency",     "Record latency histograms in the statistics" },
     { '4', "inet",        "Listen on IPv4 only" },
     { '6', "inet6",       "Listen on IPv6 only" },
     { 'u', "udp",         "Listen on UDP only" },
@@ -106,18 +145,64 @@ int main(int argc, char *argv[])
   struct host   *hosts        = NULL;
   const char    *prog_name;
   const char    *pid_file     = NULL;
+  const char    *stats_file   = NULL;
+  const char    *handoff_path = NULL;
+  const char    *numa_if      = NULL;
+  int            handoff_sd   = -1;
+  int            fds[HANDOFF_MAX_FDS];
+  unsigned int   nb_fds       = 0;
+  unsigned int   stats_flags  = 0;
   const char    *user         = NULL;
-  unsigned long  server_flags = 0;
-  unsigned int   max_clients  = 64;
-  unsigned int   timeout      = 100;
   unsigned int   loglevel     = LOG_NOTICE;
   int            exit_status  = EXIT_FAILURE;
   int            only_udp  = 0, only_tcp   = 0;
   int            only_inet = 0, only_inet6 = 0;
   int            n;
 
+  struct srv_config config = {
+    .flags       = 0,
+    .engine      = ENGINE_FORK,
+    .max_clients = 64,
+    .timeout     = 100,
+    .batch       = 1,
+    .workers     = 1,
+    .buffer_size = DEFAULT_BUFFER_SIZE,
+    .busy_poll   = 0,
+    .backlog     = DEFAULT_BACKLOG,
+    .fastopen    = 0,
+    .defer_accept = 0,
+    .rate_packets = 0,
+    .rate_bytes   = 0,
+    .flows        = 0,
+    .flow_timeout = DEFAULT_FLOW_TIMEOUT,
+    .zerocopy     = 0,
+    .burst        = 1,
+    .packet_if    = NULL,
+    .numa_node    = NUMA_NONE
+  };
+
   enum opt {
-    OPT_COMMIT = 0x100
+    OPT_COMMIT = 0x100,
+    OPT_BUSY_POLL,
+    OPT_BACKLOG,
+    OPT_FASTOPEN,
+    OPT_DEFER_ACCEPT,
+    OPT_NODELAY,
+    OPT_QUICKACK,
+    OPT_ZEROCOPY,
+    OPT_SINGLE,
+    OPT_DUAL_STACK,
+    OPT_STEER_CPU,
+    OPT_NUMA,
+    OPT_RATE_LIMIT,
+    OPT_RATE_LIMIT_BYTES,
+    OPT_FLOWS,
+    OPT_FLOW_TIMEOUT,
+    OPT_REFLECTOR,
+    OPT_SOURCE,
+    OPT_BURST,
+    OPT_PACKET,
+    OPT_HANDOFF
   };
 
   struct option opts[] = {
@@ -132,6 +217,36 @@ int main(int argc, char *argv[])
     { "log-level", required_argument, NULL, 'l' },
     { "max-clients", required_argument, NULL, 'c' },
     { "timeout", required_argument, NULL, 'T' },
+    { "engine", required_argument, NULL, 'e' },
+    { "stream", no_argument, NULL, 's' },
+    { "batch", required_argument, NULL, 'b' },
+    { "buffer-size", required_argument, NULL, 'B' },
+    { "huge-pages", no_argument, NULL, 'H' },
+    { "gro", no_argument, NULL, 'G' },
+    { "workers", required_argument, NULL, 'w' },
+    { "pin-cpu", no_argument, NULL, 'P' },
+    { "steer-cpu", no_argument, NULL, OPT_STEER_CPU },
+    { "numa", required_argument, NULL, OPT_NUMA },
+    { "single", no_argument, NULL, OPT_SINGLE },
+    { "dual-stack", no_argument, NULL, OPT_DUAL_STACK },
+    { "rate-limit", required_argument, NULL, OPT_RATE_LIMIT },
+    { "rate-limit-bytes", required_argument, NULL, OPT_RATE_LIMIT_BYTES },
+    { "flows", required_argument, NULL, OPT_FLOWS },
+    { "flow-timeout", required_argument, NULL, OPT_FLOW_TIMEOUT },
+    { "reflector", no_argument, NULL, OPT_REFLECTOR },
+    { "source", no_argument, NULL, OPT_SOURCE },
+    { "burst", required_argument, NULL, OPT_BURST },
+    { "packet", required_argument, NULL, OPT_PACKET },
+    { "busy-poll", required_argument, NULL, OPT_BUSY_POLL },
+    { "backlog", required_argument, NULL, OPT_BACKLOG },
+    { "fastopen", required_argument, NULL, OPT_FASTOPEN },
+    { "defer-accept", required_argument, NULL, OPT_DEFER_ACCEPT },
+    { "nodelay", no_argument, NULL, OPT_NODELAY },
+    { "quickack", no_argument, NULL, OPT_QUICKACK },
+    { "zerocopy", required_argument, NULL, OPT_ZEROCOPY },
+    { "handoff", required_argument, NULL, OPT_HANDOFF },
+    { "stats", required_argument, NULL, 'S' },
+    { "latency", no_argument, NULL, 'L' },
     { "inet", no_argument, NULL, '4' },
     { "inet6", no_argument, NULL, '6' },
     { "udp", no_argument, NULL, 'u' },
@@ -145,14 +260,14 @@ int main(int argc, char *argv[])
   prog_name = basename(argv[0]);
 
   while(1) {
-    int c = getopt_long(argc, argv, "hVdU:p:l:c:T:46ut", opts, NULL);
+    int c = getopt_long(argc, argv, "hVdU:p:l:c:T:e:sb:B:HGw:PS:L46ut", opts, NULL);
 
     if(c == -1)
       break;
 
     switch(c) {
     case 'd':
-      server_flags |= SRV_DAEMON;
+      config.flags |= SRV_DAEMON;
       break;
     case 'U':
       user = optarg;
@@ -194,15 +309,194 @@ int main(int argc, char *argv[])
       }
       break;
     case 'c':
-      max_clients = xatou(optarg, &n);
+      config.max_clients = xatou(optarg, &n);
       if(n)
         errx(EXIT_FAILURE, "invalid maximum number of clients");
       break;
     case 'T':
-      timeout = xatou(optarg, &n);
+      config.timeout = xatou(optarg, &n);
       if(n)
         errx(EXIT_FAILURE, "invalid timeout value");
       break;
+    case 'e':
+      if(!strcmp(optarg, "fork"))
+        config.engine = ENGINE_FORK;
+      else if(!strcmp(optarg, "prefork"))
+        config.engine = ENGINE_PREFORK;
+#ifdef __linux__
+      else if(!strcmp(optarg, "event"))
+        config.engine = ENGINE_EVENT;
+#endif
+#ifdef USE_URING
+      else if(!strcmp(optarg, "uring"))
+        config.engine = ENGINE_URING;
+#endif
+      else
+        errx(EXIT_FAILURE, "invalid or unsupported engine");
+      break;
+    case 's':
+      config.flags |= SRV_STREAM;
+      break;
+    case 'b':
+      config.batch = xatou(optarg, &n);
+      if(n || !config.batch || config.batch > MAX_BATCH)
+        errx(EXIT_FAILURE, "invalid batch size (1 to %d)", MAX_BATCH);
+#ifndef MSG_WAITFORONE
+      if(config.batch > 1)
+        errx(EXIT_FAILURE, "batching not supported on this platform");
+#endif
+      break;
+    case 'B':
+      config.buffer_size = xatou(optarg, &n);
+      if(n || !config.buffer_size || config.buffer_size > MAX_BUFFER_SIZE)
+        errx(EXIT_FAILURE, "invalid buffer size (1 to %d)", MAX_BUFFER_SIZE);
+      break;
+    case 'H':
+      config.flags |= SRV_HUGE_PAGES;
+      break;
+    case 'G':
+#ifndef UDP_GRO
+      errx(EXIT_FAILURE, "UDP GRO not supported on this platform");
+#endif
+      config.flags |= SRV_GRO;
+      break;
+    case 'w':
+      config.workers = xatou(optarg, &n);
+      if(n || !config.workers)
+        errx(EXIT_FAILURE, "invalid number of workers");
+#ifndef SO_REUSEPORT
+      if(config.workers > 1)
+        errx(EXIT_FAILURE, "multiple workers not supported on this platform");
+#endif
+      break;
+    case 'P':
+      config.flags |= SRV_PIN_CPU;
+      break;
+    case OPT_STEER_CPU:
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+      errx(EXIT_FAILURE, "CPU steering not supported on this platform");
+#endif
+      config.flags |= SRV_STEER_CPU | SRV_PIN_CPU;
+      break;
+    case OPT_NUMA:
+#ifndef __linux__
+      errx(EXIT_FAILURE, "NUMA placement not supported on this platform");
+#endif
+      /* a node, spread or the node of an interface */
+      if(!strcmp(optarg, "spread"))
+        config.numa_node = NUMA_SPREAD;
+      else {
+        config.numa_node = xatou(optarg, &n);
+        if(n) {
+          config.numa_node = NUMA_NONE;
+          numa_if = optarg;
+        }
+      }
+      break;
+    case OPT_SINGLE:
+      config.flags |= SRV_SINGLE;
+      break;
+    case OPT_DUAL_STACK:
+      config.flags |= SRV_DUAL_STACK;
+      break;
+    case OPT_RATE_LIMIT:
+      config.rate_packets = xatou(optarg, &n);
+      if(n || !config.rate_packets)
+        errx(EXIT_FAILURE, "invalid rate limit");
+      break;
+    case OPT_RATE_LIMIT_BYTES:
+      config.rate_bytes = xatou(optarg, &n);
+      if(n || !config.rate_bytes)
+        errx(EXIT_FAILURE, "invalid rate limit");
+      break;
+    case OPT_FLOWS:
+      config.flows = xatou(optarg, &n);
+      if(n || !config.flows || config.flows > MAX_FLOWS)
+        errx(EXIT_FAILURE, "invalid number of flows");
+#ifndef SO_REUSEPORT
+      errx(EXIT_FAILURE, "UDP flows not supported on this platform");
+#endif
+      break;
+    case OPT_FLOW_TIMEOUT:
+      config.flow_timeout = xatou(optarg, &n);
+      if(n || !config.flow_timeout)
+        errx(EXIT_FAILURE, "invalid flow timeout");
+      break;
+    case OPT_REFLECTOR:
+#ifdef DISCARDD
+      errx(EXIT_FAILURE, "the discard service does not answer");
+#endif
+      config.flags |= SRV_REFLECTOR;
+      break;
+    case OPT_SOURCE:
+#ifdef DISCARDD
+      errx(EXIT_FAILURE, "the discard service does not answer");
+#endif
+      config.flags |= SRV_SOURCE;
+      break;
+    case OPT_BURST:
+      config.burst = xatou(optarg, &n);
+      if(n || !config.burst || config.burst > MAX_BATCH)
+        errx(EXIT_FAILURE, "invalid burst (1 to %d)", MAX_BATCH);
+      break;
+    case OPT_PACKET:
+#ifndef __linux__
+      errx(EXIT_FAILURE, "packet rings not supported on this platform");
+#endif
+      config.packet_if = optarg;
+      break;
+    case OPT_BUSY_POLL:
+      config.busy_poll = xatou(optarg, &n);
+      if(n || !config.busy_poll)
+        errx(EXIT_FAILURE, "invalid busy poll budget");
+      break;
+    case OPT_BACKLOG:
+      config.backlog = xatou(optarg, &n);
+      if(n || !config.backlog)
+        errx(EXIT_FAILURE, "invalid backlog");
+      break;
+    case OPT_FASTOPEN:
+#ifndef TCP_FASTOPEN
+      errx(EXIT_FAILURE, "TCP Fast Open not supported on this platform");
+#endif
+      config.fastopen = xatou(optarg, &n);
+      if(n || !config.fastopen)
+        errx(EXIT_FAILURE, "invalid Fast Open queue length");
+      break;
+    case OPT_DEFER_ACCEPT:
+#if !defined(TCP_DEFER_ACCEPT) && !defined(SO_ACCEPTFILTER)
+      errx(EXIT_FAILURE, "deferred accept not supported on this platform");
+#endif
+      config.defer_accept = xatou(optarg, &n);
+      if(n || !config.defer_accept)
+        errx(EXIT_FAILURE, "invalid deferred accept timeout");
+      break;
+    case OPT_NODELAY:
+      config.flags |= SRV_NODELAY;
+      break;
+    case OPT_QUICKACK:
+#ifndef TCP_QUICKACK
+      errx(EXIT_FAILURE, "TCP quick ACK not supported on this platform");
+#endif
+      config.flags |= SRV_QUICKACK;
+      break;
+    case OPT_ZEROCOPY:
+#ifndef MSG_ZEROCOPY
+      errx(EXIT_FAILURE, "zero copy not supported on this platform");
+#endif
+      config.zerocopy = xatou(optarg, &n);
+      if(n || !config.zerocopy)
+        errx(EXIT_FAILURE, "invalid zero copy threshold");
+      break;
+    case OPT_HANDOFF:
+      handoff_path = optarg;
+      break;
+    case 'S':
+      stats_file = optarg;
+      break;
+    case 'L':
+      stats_flags |= STATS_LATENCY;
+      break;
     case '4':
       only_inet  = 1;
       break;
@@ -236,6 +530,89 @@ int main(int argc, char *argv[])
   argc -= optind;
   argv += optind;
 
+  /* GRO already coalesces the datagrams in its own loop */
+  if(config.flags & SRV_GRO && (config.batch > 1 || config.engine == ENGINE_URING))
+    errx(EXIT_FAILURE, "UDP GRO cannot be used with batching or the uring engine");
+
+  /* the single process only answers datagrams one by one
+     and forks for each client */
+  if(config.flags & SRV_SINGLE &&
+     (config.engine != ENGINE_FORK || config.workers > 1 || config.batch > 1 ||
+      config.flags & SRV_GRO || config.busy_poll))
+    errx(EXIT_FAILURE, "single process mode needs the fork engine without workers, "
+                       "batching, GRO or busy polling");
+
+  /* Flows are forked from the plain UDP loop. They are bound after the
+     listeners dropped privileges which the kernel would not allow. */
+  if(config.flows &&
+     (config.flags & (SRV_SINGLE | SRV_GRO) || config.batch > 1 ||
+      config.engine == ENGINE_URING))
+    errx(EXIT_FAILURE, "UDP flows cannot be used with the single process mode, "
+                       "batching, GRO or the uring engine");
+  if(config.flows && user)
+    errx(EXIT_FAILURE, "UDP flows cannot be used when dropping privileges");
+
+  /* The source sends from its own pattern, not from the
+     receive buffers, and serves each client in a process. */
+  if(config.flags & SRV_SOURCE &&
+     (config.flags & (SRV_STREAM | SRV_GRO | SRV_REFLECTOR) || config.batch > 1 ||
+      config.flows || config.zerocopy ||
+      (config.engine != ENGINE_FORK && config.engine != ENGINE_PREFORK)))
+    errx(EXIT_FAILURE, "source needs the fork or prefork engine without stream mode, "
+                       "batching, GRO, flows, reflector or zero copy");
+  if(config.burst > 1 && !(config.flags & SRV_SOURCE))
+    errx(EXIT_FAILURE, "bursts need the source mode");
+
+  /* The rings replace the whole UDP loop. The packet socket
+     is bound after the privileges are dropped. */
+  if(config.packet_if &&
+     (config.flags & (SRV_SINGLE | SRV_GRO | SRV_REFLECTOR | SRV_SOURCE) ||
+      config.batch > 1 || config.flows || config.engine == ENGINE_URING))
+    errx(EXIT_FAILURE, "packet rings cannot be used with the single process mode, "
+                       "batching, GRO, flows, reflector, source or the uring engine");
+  if(config.packet_if && user)
+    errx(EXIT_FAILURE, "packet rings cannot be used when dropping privileges");
+
+  /* the rings only take the frames of the family of the socket */
+  if(config.packet_if && config.flags & SRV_DUAL_STACK)
+    errx(EXIT_FAILURE, "packet rings cannot be used with dual-stack");
+
+  /* The flows join the group of the listening sockets
+     and would shift the index of the workers. */
+  if(config.flags & SRV_STEER_CPU &&
+     (config.flags & SRV_SINGLE || config.workers < 2 || config.flows))
+    errx(EXIT_FAILURE, "CPU steering needs workers without the single process mode or flows");
+
+  /* the steering program expects the workers on all the nodes */
+  if(config.flags & SRV_STEER_CPU && config.numa_node == NUMA_SPREAD)
+    errx(EXIT_FAILURE, "CPU steering cannot be used with NUMA spread");
+
+  /* GRO stamps a single time for many datagrams */
+  if(config.flags & SRV_REFLECTOR &&
+     (config.flags & SRV_GRO || config.engine == ENGINE_URING || config.flows))
+    errx(EXIT_FAILURE, "reflector cannot be used with GRO, flows or the uring engine");
+  if(config.flags & SRV_REFLECTOR && config.buffer_size < TWAMP_REFLECTOR_SIZE)
+    errx(EXIT_FAILURE, "reflector needs a buffer of at least %d bytes", TWAMP_REFLECTOR_SIZE);
+
+  /* Streams are already spliced without copy. The other engines
+     share their buffer among the clients. */
+  if(config.zerocopy &&
+     (config.flags & SRV_STREAM ||
+      (config.engine != ENGINE_FORK && config.engine != ENGINE_PREFORK)))
+    errx(EXIT_FAILURE, "zero copy needs the fork or prefork engine without stream mode");
+
+  /* the dual-stack socket replaces the IPv4 one */
+  if(config.flags & SRV_DUAL_STACK && (only_inet || only_inet6))
+    errx(EXIT_FAILURE, "dual-stack needs both IPv4 and IPv6");
+
+  /* histograms are part of the statistics */
+  if((stats_flags & STATS_LATENCY) && !stats_file)
+    errx(EXIT_FAILURE, "latency histograms need a statistics file");
+
+  /* the pool size is the maximum number of clients */
+  if(config.engine == ENGINE_PREFORK && !config.max_clients)
+    errx(EXIT_FAILURE, "prefork engine needs a maximum number of clients");
+
   /* parse address and port number */
   for(; *argv; argv++) {
     const char *host, *port;
@@ -263,15 +640,15 @@ int main(int argc, char *argv[])
      the default. The same applies for INET/INET6. */
   if(!(only_udp && only_tcp)) {
     if(only_udp)
-      server_flags |= SRV_UDP;
+      config.flags |= SRV_UDP;
     if(only_tcp)
-      server_flags |= SRV_TCP;
+      config.flags |= SRV_TCP;
   }
   if(!(only_inet && only_inet6)) {
     if(only_inet)
-      server_flags |= SRV_INET;
+      config.flags |= SRV_INET;
     if(only_inet6)
-      server_flags |= SRV_INET6;
+      config.flags |= SRV_INET6;
   }
 
   /* syslog and start notification */
@@ -280,14 +657,30 @@ int main(int argc, char *argv[])
   safecall_err_act = safecall_act_sysstd;
 
   /* daemon mode */
-  if(server_flags & SRV_DAEMON) {
+  if(config.flags & SRV_DAEMON) {
     if(daemon(0, 0) < 0)
       sysstd_abort("cannot switch to daemon mode");
     sysstd_log(LOG_INFO, "switched to daemon mode");
   }
 
+  /* The master is placed first so that the listeners and the
+     memory they share are on the node (e.g. that of the NIC).
+     Otherwise each worker places itself. */
+  if(numa_if) {
+    config.numa_node = interface_node(numa_if);
+    if(config.numa_node < 0)
+      sysstd_log(LOG_WARNING, "no NUMA node for %s, workers are not placed", numa_if);
+  }
+  if(config.numa_node >= 0) {
+    bind_node(config.numa_node);
+    sysstd_log(LOG_INFO, "workers placed on NUMA node %d", config.numa_node);
+  }
+  else if(config.numa_node == NUMA_SPREAD)
+    sysstd_log(LOG_INFO, "workers spread over %u NUMA nodes", node_count());
+
   /* setup:
       - write pid
+      - map statistics
       - bind to privilegied port
       - drop privileges
       - setup signals
@@ -295,10 +688,37 @@ int main(int argc, char *argv[])
   if(pid_file)
     write_pid(pid_file);
 
+  /* shared by all the listeners */
+  if(stats_file)
+    stats_open(stats_file, stats_flags);
+
+  /* summaries of the events of the listeners */
+  evlog_init();
+
+  /* pattern shared by all the listeners */
+  if(config.flags & SRV_SOURCE)
+    source_init();
+
+  /* sockets from a running daemon or the service manager */
+  if(handoff_path)
+    nb_fds = handoff_receive(handoff_path, fds, HANDOFF_MAX_FDS);
+  if(!nb_fds)
+    nb_fds = listen_fds(fds, HANDOFF_MAX_FDS);
+
   /* bind before we drop privileges */
-  n = bind_server(hosts, server_flags);
+  if(nb_fds)
+    n = inherit_server(fds, nb_fds, &config);
+  else
+    n = bind_server(hosts, &config);
   free_hosts(hosts);
 
+  /* The previous daemon drains once our listeners are running.
+     The handoff socket is bound before we drop privileges. */
+  if(n && handoff_path) {
+    handoff_ack();
+    handoff_sd = handoff_listen(handoff_path);
+  }
+
   if(user) {
     drop_privileges(user);
     sysstd_log(LOG_INFO, "privileges dropped to %s", user);
@@ -307,9 +727,23 @@ int main(int argc, char *argv[])
   setup_signals();
 
   if(!n) /* child */
-    server(max_clients, timeout);
-  else /* parent */
-    while(wait(NULL) > 0);
+    server(&config);
+  else if(handoff_sd >= 0) { /* parent */
+    int *sockets = server_sockets(&nb_fds);
+
+    if(handoff_wait(handoff_sd, sockets, nb_fds)) {
+      sysstd_log(LOG_NOTICE, "sockets handed over, draining...");
+      drain_server(DRAIN_TIMEOUT);
+      exit_status = EXIT_SUCCESS;
+    }
+  }
+  else { /* parent */
+    /* SIGCHLD is ignored, this fails once all the listeners exited */
+    while(waitpid(-1, NULL, WNOHANG) >= 0) {
+      sleep(EVLOG_INTERVAL);
+      evlog_flush();
+    }
+  }
 
 EXIT:
   exit(exit_status);
@@ -0,0 +1,561 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <syslog.h>
+
+#include <gawen/common.h>
+#include <gawen/log.h>
+
+#include "packet.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+
+#include "stats.h"
+#include "ratelimit.h"
+#include "handoff.h"
+#include "evlog.h"
+
+/* Receive ring of blocks filled with frames by the kernel. A block is
+   handed over once full or after a timeout, the latter bounds the
+   latency when the rate is low. The transmit ring has fixed frames. */
+#define RX_BLOCK_SIZE    (1 << 18)
+#define RX_BLOCK_NR      16
+#define RX_BLOCK_TIMEOUT 1 /* ms */
+#define TX_FRAME_SIZE    2048
+#define TX_FRAME_NR      2048
+
+/* Hop limit of the answers. */
+#define ANSWER_TTL 64
+
+/* Datagrams answered from the UDP socket before we check the rings. */
+#define SOCKET_BUDGET 64
+
+#define ETH_HLEN_ 14 /* no VLAN tag */
+#define UDP_HLEN  8
+
+/* Largest frame that fits in a transmit frame after its header. */
+#define TX_DATA_SIZE (TX_FRAME_SIZE - (TPACKET3_HDRLEN - sizeof(struct sockaddr_ll)))
+
+static int            packet_sd;
+static unsigned char *rx_ring;
+static unsigned char *tx_ring;
+static unsigned int   rx_block;
+static unsigned int   tx_pending;
+
+/* listening address, the address is ignored when unspecified */
+static int           listen_af;
+static uint16_t      listen_port;
+static unsigned char listen_addr[16];
+static int           listen_any;
+
+/* largest IP datagram answered from the rings */
+static size_t        answer_max;
+
+/* Only accept the UDP datagrams to the port of the listener. IPv4
+   fragments and IPv6 extension headers are left to the socket. */
+static void attach_filter(int sd, int af, uint16_t port)
+{
+  struct sock_filter inet[] = {
+    BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 12),                 /* ethertype */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IP, 0, 8),
+    BPF_STMT(BPF_LD  | BPF_B | BPF_ABS, 23),                 /* protocol */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 6),
+    BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 20),                 /* fragment */
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, 4, 0),
+    BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, ETH_HLEN_),          /* header length */
+    BPF_STMT(BPF_LD  | BPF_H | BPF_IND, ETH_HLEN_ + 2),      /* port */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+    BPF_STMT(BPF_RET | BPF_K, 0)
+  };
+  struct sock_filter inet6[] = {
+    BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 12),                 /* ethertype */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IPV6, 0, 5),
+    BPF_STMT(BPF_LD  | BPF_B | BPF_ABS, 20),                 /* next header */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 3),
+    BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, ETH_HLEN_ + 40 + 2), /* port */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+    BPF_STMT(BPF_RET | BPF_K, 0)
+  };
+  struct sock_fprog prog;
+
+  if(af == AF_INET)
+    prog = (struct sock_fprog){ .len = sizeof_array(inet),  .filter = inet };
+  else
+    prog = (struct sock_fprog){ .len = sizeof_array(inet6), .filter = inet6 };
+
+  if(setsockopt(sd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+    sysstd_abort("cannot attach packet filter");
+}
+
+/* The kernel still delivers each datagram to the UDP socket. Drop
+   those already answered from the rings, that is unicast datagrams
+   received on their interface without extension header and small
+   enough for an answer. The kernel reassembles fragments before the
+   filter, those larger than the MTU were not seen whole by the rings. */
+static void drop_socket(int sd, unsigned int ifindex)
+{
+  unsigned int proto_off = listen_af == AF_INET ? 9 : 6;
+  unsigned int len_off   = listen_af == AF_INET ? 2 : 4;
+  unsigned int len_max   = listen_af == AF_INET ? answer_max : answer_max - 40;
+  struct sock_filter drop[] = {
+    BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ifindex, 0, 7),
+    BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_HOST, 0, 5),
+    BPF_STMT(BPF_LD  | BPF_B | BPF_ABS, SKF_NET_OFF + proto_off), /* next header */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 3),
+    BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, SKF_NET_OFF + len_off),   /* length */
+    BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, len_max, 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+    BPF_STMT(BPF_RET | BPF_K, 0xffffffff)
+  };
+  struct sock_fprog prog = { .len = sizeof_array(drop), .filter = drop };
+
+  if(setsockopt(sd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+    sysstd_abort("cannot attach socket filter");
+}
+
+/* Answer at most the MTU of the interface so that the socket can tell
+   reassembled datagrams from those answered by the rings. */
+static void answer_size(int sd, const char *ifname)
+{
+  struct ifreq ifr = { .ifr_mtu = 0 };
+
+  strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+  if(ioctl(sd, SIOCGIFMTU, &ifr) < 0)
+    sysstd_abort("cannot get MTU of %s", ifname);
+
+  answer_max = TX_DATA_SIZE - ETH_HLEN_;
+  if((size_t)ifr.ifr_mtu < answer_max)
+    answer_max = ifr.ifr_mtu;
+}
+
+/* Workers of the same address share the frames by flow. The group
+   is unique to the address so that no other listener gets them. */
+static void join_fanout(int sd)
+{
+  uint32_t id = listen_af * 31 + listen_port;
+  int optval;
+  unsigned int i;
+
+  for(i = 0 ; i < sizeof(listen_addr) ; i++)
+    id = id * 31 + listen_addr[i];
+
+  optval = (id & 0xffff) | PACKET_FANOUT_HASH << 16;
+  if(setsockopt(sd, SOL_PACKET, PACKET_FANOUT, &optval, sizeof(optval)) < 0)
+    sysstd_abort("cannot join packet fanout group");
+}
+
+static void packet_open(int ifindex)
+{
+  struct tpacket_req3 rx_req = { .tp_block_size       = RX_BLOCK_SIZE,
+                                 .tp_block_nr         = RX_BLOCK_NR,
+                                 .tp_frame_size       = TX_FRAME_SIZE,
+                                 .tp_frame_nr         = RX_BLOCK_SIZE / TX_FRAME_SIZE * RX_BLOCK_NR,
+                                 .tp_retire_blk_tov   = RX_BLOCK_TIMEOUT };
+  struct tpacket_req3 tx_req = { .tp_block_size       = TX_FRAME_SIZE * 64,
+                                 .tp_block_nr         = TX_FRAME_NR / 64,
+                                 .tp_frame_size       = TX_FRAME_SIZE,
+                                 .tp_frame_nr         = TX_FRAME_NR };
+  struct sockaddr_ll sll = { .sll_family   = AF_PACKET,
+                             .sll_protocol = htons(ETH_P_ALL),
+                             .sll_ifindex  = ifindex };
+  size_t rx_size = (size_t)RX_BLOCK_SIZE * RX_BLOCK_NR;
+  size_t tx_size = (size_t)TX_FRAME_SIZE * TX_FRAME_NR;
+  int optval;
+  void *p;
+
+  /* nothing is received until bound */
+  packet_sd = socket(AF_PACKET, SOCK_RAW, 0);
+  if(packet_sd < 0)
+    sysstd_abort("cannot create packet socket");
+
+  attach_filter(packet_sd, listen_af, listen_port);
+
+  optval = TPACKET_V3;
+  if(setsockopt(packet_sd, SOL_PACKET, PACKET_VERSION, &optval, sizeof(optval)) < 0)
+    sysstd_abort("cannot use packet ring version 3");
+
+  /* the answers do not go through the queueing discipline */
+  optval = 1;
+  setsockopt(packet_sd, SOL_PACKET, PACKET_QDISC_BYPASS, &optval, sizeof(optval));
+#ifdef PACKET_IGNORE_OUTGOING
+  setsockopt(packet_sd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &optval, sizeof(optval));
+#endif
+
+  if(setsockopt(packet_sd, SOL_PACKET, PACKET_RX_RING, &rx_req, sizeof(rx_req)) < 0)
+    sysstd_abort("cannot create packet receive ring");
+  if(setsockopt(packet_sd, SOL_PACKET, PACKET_TX_RING, &tx_req, sizeof(tx_req)) < 0)
+    sysstd_abort("cannot create packet transmit ring");
+
+  /* both rings in a single mapping, receive first */
+  p = mmap(NULL, rx_size + tx_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, packet_sd, 0);
+  if(p == MAP_FAILED)
+    p = mmap(NULL, rx_size + tx_size, PROT_READ | PROT_WRITE, MAP_SHARED, packet_sd, 0);
+  if(p == MAP_FAILED)
+    sysstd_abort("cannot map packet rings");
+  rx_ring = p;
+  tx_ring = rx_ring + rx_size;
+
+  if(bind(packet_sd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+    sysstd_abort("cannot bind packet socket");
+
+  join_fanout(packet_sd);
+}
+
+/* One's complement sum in network order. */
+static uint32_t csum_add(uint32_t sum, const unsigned char *p, size_t len)
+{
+  size_t i;
+
+  for(i = 0 ; i + 1 < len ; i += 2)
+    sum += p[i] << 8 | p[i + 1];
+  if(len & 1)
+    sum += p[len - 1] << 8;
+  return sum;
+}
+
+static uint16_t csum_fold(uint32_t sum)
+{
+  while(sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+/* The kernel leaves the checksum to the device for local senders
+   (veth), we complete it since the answer goes back as is. */
+static void udp_checksum(unsigned char *udp, size_t len,
+                         const unsigned char *addrs, size_t addrs_len)
+{
+  uint32_t sum = IPPROTO_UDP + len;
+  uint16_t check;
+
+  udp[6] = udp[7] = 0;
+  sum   = csum_add(sum, addrs, addrs_len);
+  sum   = csum_add(sum, udp, len);
+  check = csum_fold(sum);
+  if(!check)
+    check = 0xffff;
+
+  udp[6] = check >> 8;
+  udp[7] = check;
+}
+
+static void swap(unsigned char *a, unsigned char *b, size_t len)
+{
+  unsigned char tmp[16];
+
+  memcpy(tmp, a, len);
+  memcpy(a, b, len);
+  memcpy(b, tmp, len);
+}
+
+/* Turn the frame into its answer. Return the length of the answer
+   and the UDP payload, zero when the frame is not for us. */
+static size_t reflect(unsigned char *frame, size_t len, int csum_partial,
+                      struct sockaddr_storage *from, size_t *payload)
+{
+  unsigned char *ip = frame + ETH_HLEN_, *udp;
+  size_t ihl, total, udp_len;
+
+  if(listen_af == AF_INET) {
+    struct sockaddr_in *from4 = (struct sockaddr_in *)from;
+    uint32_t sum;
+
+    if(len < ETH_HLEN_ + 20 + UDP_HLEN)
+      return 0;
+    ihl   = (ip[0] & 0xf) * 4;
+    total = ip[2] << 8 | ip[3];
+    if(ihl < 20 || total < ihl + UDP_HLEN || ETH_HLEN_ + total > len)
+      return 0;
+    if(!listen_any && memcmp(ip + 16, listen_addr, 4))
+      return 0;
+    udp     = ip + ihl;
+    udp_len = total - ihl;
+
+    *from4 = (struct sockaddr_in){ .sin_family = AF_INET };
+    memcpy(&from4->sin_addr, ip + 12, 4);
+    memcpy(&from4->sin_port, udp, 2);
+
+    if(csum_partial)
+      udp_checksum(udp, udp_len, ip + 12, 8);
+
+    /* the checksum covers the TTL along with the protocol */
+    sum = (uint16_t)~(ip[10] << 8 | ip[11]);
+    sum += (uint16_t)~(ip[8] << 8 | ip[9]);
+    ip[8] = ANSWER_TTL;
+    sum += ip[8] << 8 | ip[9];
+    sum  = csum_fold(sum);
+    ip[10] = sum >> 8;
+    ip[11] = sum;
+
+    swap(ip + 12, ip + 16, 4);
+  }
+  else {
+    struct sockaddr_in6 *from6 = (struct sockaddr_in6 *)from;
+
+    if(len < ETH_HLEN_ + 40 + UDP_HLEN)
+      return 0;
+    total = 40 + (ip[4] << 8 | ip[5]);
+    if(total < 40 + UDP_HLEN || ETH_HLEN_ + total > len)
+      return 0;
+    if(!listen_any && memcmp(ip + 24, listen_addr, 16))
+      return 0;
+    udp     = ip + 40;
+    udp_len = total - 40;
+
+    *from6 = (struct sockaddr_in6){ .sin6_family = AF_INET6 };
+    memcpy(&from6->sin6_addr, ip + 8, 16);
+    memcpy(&from6->sin6_port, udp, 2);
+
+    if(csum_partial)
+      udp_checksum(udp, udp_len, ip + 8, 32);
+
+    ip[7] = ANSWER_TTL;
+    swap(ip + 8, ip + 24, 16);
+  }
+
+  /* addresses and ports swapped, the checksums stay the same */
+  swap(frame, frame + 6, 6);
+  swap(udp, udp + 2, 2);
+
+  *payload = udp_len - UDP_HLEN;
+  return ETH_HLEN_ + total;
+}
+
+/* Hand the queued answers over to the kernel. */
+static void tx_flush(int wait)
+{
+  if(!tx_pending)
+    return;
+
+  if(send(packet_sd, NULL, 0, wait ? 0 : MSG_DONTWAIT) < 0 &&
+     errno != EAGAIN && errno != ENOBUFS && errno != EINTR) {
+    stat_inc(STAT_TX_ERRORS);
+    evlog(EV_SEND_ERROR, errno);
+  }
+  tx_pending = 0;
+}
+
+#ifndef DISCARDD
+static unsigned int tx_frame;
+
+/* Next free frame of the transmit ring, NULL when the ring is full. */
+static struct tpacket3_hdr * tx_next(void)
+{
+  struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)(tx_ring + (size_t)tx_frame * TX_FRAME_SIZE);
+  unsigned int status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+
+  if(status == TP_STATUS_WRONG_FORMAT) {
+    stat_inc(STAT_TX_ERRORS);
+    status = TP_STATUS_AVAILABLE;
+  }
+
+  /* wait for the kernel to send what we queued */
+  if(status != TP_STATUS_AVAILABLE) {
+    tx_flush(1);
+    status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+    if(status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT)
+      return NULL;
+  }
+
+  tx_frame = (tx_frame + 1) % TX_FRAME_NR;
+  return hdr;
+}
+#endif /* DISCARDD */
+
+static void answer(struct tpacket3_hdr *rx, uint64_t received)
+{
+  unsigned char *frame = (unsigned char *)rx + rx->tp_mac;
+  const struct sockaddr_ll *sll = (const struct sockaddr_ll *)((unsigned char *)rx +
+                                    TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+  struct sockaddr_storage from;
+  size_t len, payload;
+#ifndef DISCARDD
+  struct tpacket3_hdr *tx;
+#endif
+
+  /* frames for another host, or sent by this one */
+  if(sll->sll_pkttype != PACKET_HOST || rx->tp_status & TP_STATUS_VLAN_VALID)
+    return;
+
+  len = reflect(frame, rx->tp_snaplen, rx->tp_status & TP_STATUS_CSUMNOTREADY, &from, &payload);
+  if(!len)
+    return;
+
+  /* too large for an answer, left to the socket */
+  if(len > ETH_HLEN_ + answer_max)
+    return;
+
+  stat_inc(STAT_RX_PACKETS);
+  stat_add(STAT_RX_BYTES, payload);
+
+  /* truncated by the ring */
+  if(rx->tp_snaplen < rx->tp_len) {
+    stat_inc(STAT_TRUNCATED);
+    evlog(EV_TRUNCATED, 0);
+    return;
+  }
+
+#ifndef DISCARDD
+  if(!ratelimit((struct sockaddr *)&from, 1, payload, ratelimit_clock())) {
+    stat_inc(STAT_LIMITED);
+    return;
+  }
+
+  tx = tx_next();
+  if(!tx) {
+    stat_inc(STAT_TX_ERRORS);
+    evlog(EV_SEND_ERROR, ENOBUFS);
+    return;
+  }
+
+  memcpy((unsigned char *)tx + TPACKET3_HDRLEN - sizeof(struct sockaddr_ll), frame, len);
+  tx->tp_len = len;
+  __atomic_store_n(&tx->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+  tx_pending++;
+
+  stat_inc(STAT_TX_PACKETS);
+  stat_add(STAT_TX_BYTES, payload);
+  stat_record(HIST_REPLY, received);
+#else
+  UNUSED(received);
+#endif
+}
+
+static void listen_address(const struct sockaddr *addr)
+{
+  static const unsigned char any[16];
+
+  listen_af = addr->sa_family;
+  if(listen_af == AF_INET) {
+    const struct sockaddr_in *addr4 = (const struct sockaddr_in *)addr;
+    listen_port = ntohs(addr4->sin_port);
+    memcpy(listen_addr, &addr4->sin_addr, 4);
+    listen_any = !memcmp(listen_addr, any, 4);
+  }
+  else {
+    const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6 *)addr;
+    listen_port = ntohs(addr6->sin6_port);
+    memcpy(listen_addr, &addr6->sin6_addr, 16);
+    listen_any = !memcmp(listen_addr, any, 16);
+  }
+}
+
+void server_udp_packet(int sd, const struct sockaddr *addr, const struct srv_config *config,
+                       int (*echo)(int flags))
+{
+  unsigned int ifindex = if_nametoindex(config->packet_if);
+
+  if(!ifindex)
+    sysstd_abort("unknown interface %s", config->packet_if);
+
+  listen_address(addr);
+  answer_size(sd, config->packet_if);
+  packet_open(ifindex);
+
+  /* The filter stays on the socket, which is shared with the daemon
+     we hand it over to. The latter replaces it with its own. */
+  drop_socket(sd, ifindex);
+
+  while(1) {
+    struct tpacket_block_desc *block = (struct tpacket_block_desc *)(rx_ring + (size_t)rx_block * RX_BLOCK_SIZE);
+    struct pollfd pfds[] = { { .fd = packet_sd, .events = POLLIN | POLLERR },
+                             { .fd = sd,        .events = POLLIN } };
+    unsigned int budget = SOCKET_BUDGET;
+    struct tpacket3_hdr *rx;
+    uint64_t received;
+    unsigned int i;
+    int ready, n;
+
+    if(draining) {
+      tx_flush(1);
+      drain_exit();
+    }
+
+    /* wait only when there is no block to process */
+    ready = __atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER;
+    if(ready)
+      n = poll(pfds, sizeof_array(pfds), 0);
+    else {
+      const sigset_t *mask = drain_block();
+
+      n = draining ? 0 : ppoll(pfds, sizeof_array(pfds), NULL, mask);
+      drain_unblock();
+    }
+    if(n < 0) {
+      if(errno != EINTR)
+        sysstd_abort("poll error");
+      continue;
+    }
+
+    /* datagrams from the other interfaces */
+    if(pfds[1].revents)
+      while(budget-- && echo(MSG_DONTWAIT));
+
+    if(!ready)
+      continue;
+    received = stat_clock();
+
+    rx = (struct tpacket3_hdr *)((unsigned char *)block + block->hdr.bh1.offset_to_first_pkt);
+    for(i = 0 ; i < block->hdr.bh1.num_pkts ; i++) {
+      answer(rx, received);
+      rx = (struct tpacket3_hdr *)((unsigned char *)rx + rx->tp_next_offset);
+    }
+
+    /* one system call for the answers of the whole block */
+    __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    rx_block = (rx_block + 1) % RX_BLOCK_NR;
+    tx_flush(0);
+  }
+}
+#else
+void server_udp_packet(int sd, const struct sockaddr *addr, const struct srv_config *config,
+                       int (*echo)(int flags))
+{
+  UNUSED(sd);
+  UNUSED(addr);
+  UNUSED(config);
+  UNUSED(echo);
+
+  sysstd_abortx("packet rings are only available on Linux");
+}
+#endif /* __linux__ */
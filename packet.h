@@ -0,0 +1,46 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PACKET_H_
+#define _PACKET_H_
+
+#include <sys/socket.h>
+
+#include "echod.h"
+
+/* Answer the datagrams of an UDP listener from the link layer. A packet
+   socket bound to the interface receives the frames to the port of the
+   listener in a ring mapped in memory (TPACKET_V3) and the answers are
+   queued in a transmit ring after swapping the addresses and ports in
+   place. Many frames are received and sent for each system call. The
+   UDP socket stays bound so that the kernel does not answer with ICMP
+   errors but it drops its copy of the datagrams received on this
+   interface right away. The datagrams received on the other interfaces
+   are answered from the UDP socket with echo(), which is called with
+   MSG_DONTWAIT until it returns 0. This is only available on Linux and
+   requires the CAP_NET_RAW capability. */
+void server_udp_packet(int sd, const struct sockaddr *addr, const struct srv_config *config,
+                       int (*echo)(int flags));
+
+#endif /* _PACKET_H_ */
@@ -0,0 +1,83 @@
+#!/bin/sh
+# Check the UDP packet rings of echod (--packet) over a veth pair.
+# The daemon listens on one end and echobench runs from the other end
+# in its own network namespace, over IPv4 and IPv6. The datagrams on
+# loopback are answered from the socket instead of the rings. The
+# reflector cannot be used with the rings so TWAMP is not checked.
+# This needs root on Linux. The results are written as CSV on the
+# standard output and the exit status is non-zero on any loss.
+#
+# PACKET_PORT     port used by the daemon (default: 17007)
+# PACKET_DURATION duration of each run in seconds (default: 2)
+# PACKET_WORKERS  workers sharing the rings (default: 2)
+
+port=${PACKET_PORT:-17007}
+duration=${PACKET_DURATION:-2}
+workers=${PACKET_WORKERS:-2}
+
+ns=echod-packet
+veth=echod-pk0
+peer=echod-pk1
+
+cleanup() {
+  [ -n "$pid" ] && kill_tree "$pid"
+  ip link del "$veth" 2> /dev/null
+  ip netns del "$ns" 2> /dev/null
+}
+
+# Kill a process and its descendants, as in bench.sh.
+kill_tree() {
+  children=$(pgrep -P "$1")
+  kill "$1" 2> /dev/null
+  for child in $children
+  do
+    kill_tree "$child"
+  done
+}
+
+set -e
+trap cleanup EXIT INT TERM
+
+ip netns add "$ns"
+ip link add "$veth" type veth peer name "$peer"
+ip link set "$peer" netns "$ns"
+ip addr add 10.77.0.1/24 dev "$veth"
+ip addr add fd77::1/64 dev "$veth" nodad
+ip link set "$veth" up
+ip netns exec "$ns" ip addr add 10.77.0.2/24 dev "$peer"
+ip netns exec "$ns" ip addr add fd77::2/64 dev "$peer" nodad
+ip netns exec "$ns" ip link set "$peer" up
+ip netns exec "$ns" ip link set lo up
+set +e
+
+./echod -u -w "$workers" --packet "$veth" "*/$port" > /dev/null 2>&1 &
+pid=$!
+sleep 1
+
+# label, namespace, address
+runs="
+ring-inet   $ns  10.77.0.1
+ring-inet6  $ns  fd77::1
+socket-lo   -    127.0.0.1
+"
+
+header=-H
+failed=0
+echo "$runs" | {
+  while read label netns addr
+  do
+    [ -z "$label" ] && continue
+
+    exec=
+    [ "$netns" != - ] && exec="ip netns exec $netns"
+
+    result=$($exec ./echobench $header -u -s 64 -c 4 -r 1000 -d "$duration" \
+                               -l "$label" "$addr/$port")
+    header=
+    echo "$result"
+
+    # lost and errors columns
+    echo "$result" | tail -n 1 | awk -F, '$9 != 0 || $10 != 0 { exit 1 }' || failed=1
+  done
+  exit $failed
+}
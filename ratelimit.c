@@ -0,0 +1,158 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "ratelimit.h"
+
+/* 8192 sets of 4 sources, that is 32768 sources in 1MB.
+   A set spans two cache lines. */
+#define RATE_SETS 8192
+#define RATE_WAYS 4
+
+/* Bursts allowed after an idle period (ns). */
+#define RATE_BURST 1000000000ULL
+
+/* The buckets use the generic cell rate algorithm. Instead of tokens we
+   keep the time at which each bucket would be full again, every packet
+   pushes it further by its cost. A source is over the limit when this
+   time goes beyond the allowed burst. Empty entries and idle sources are
+   equivalent, their time is in the past. */
+struct rate_entry {
+  uint64_t addr[2];     /* IPv6 or IPv4-mapped source address */
+  uint64_t tat_packets; /* theoretical arrival time (ns) */
+  uint64_t tat_bytes;
+};
+
+struct rate_set {
+  struct rate_entry ways[RATE_WAYS];
+};
+
+struct rate_set *rate_sets;
+
+static uint64_t packet_cost; /* ns per packet */
+static uint64_t byte_cost;   /* ns per byte in 48.16 fixed point */
+static uint64_t seed;        /* spoofed sources should not target a set */
+
+void ratelimit_init(unsigned int packets, unsigned long bytes)
+{
+  struct timespec ts;
+
+  if(!packets && !bytes)
+    return;
+
+  if(packets)
+    packet_cost = RATE_BURST / packets ? RATE_BURST / packets : 1;
+  if(bytes)
+    byte_cost = (RATE_BURST << 16) / bytes ? (RATE_BURST << 16) / bytes : 1;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  seed = ((uint64_t)ts.tv_nsec << 32 ^ ts.tv_sec ^ getpid()) | 1;
+
+  rate_sets = alloc_buffers(RATE_SETS * sizeof(struct rate_set), 1, 0);
+}
+
+static struct rate_set * lookup_set(const uint64_t addr[2])
+{
+  uint64_t h = (addr[0] ^ seed) * 0x9e3779b97f4a7c15ULL;
+
+  h  = (h ^ addr[1] ^ h >> 29) * 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 32;
+
+  return &rate_sets[h & (RATE_SETS - 1)];
+}
+
+/* A bucket accepts the cost when it stays within the burst. */
+static uint64_t charge(uint64_t tat, uint64_t cost, uint64_t now, int *allowed)
+{
+  if(tat < now)
+    tat = now;
+  tat += cost;
+
+  if(tat - now > RATE_BURST)
+    *allowed = 0;
+
+  return tat;
+}
+
+int ratelimit_check(const struct sockaddr *from, unsigned int packets, size_t bytes, uint64_t now)
+{
+  struct rate_entry *e, *victim;
+  struct rate_set *set;
+  uint64_t addr[2] = { 0, 0 };
+  unsigned char *addr_bytes = (unsigned char *)addr;
+  uint64_t tat_packets = 0, tat_bytes = 0;
+  int allowed = 1;
+  unsigned int i;
+
+  switch(from->sa_family) {
+  case AF_INET:
+    /* ::ffff:0:0/96 as seen on a dual-stack socket */
+    addr_bytes[10] = addr_bytes[11] = 0xff;
+    memcpy(addr_bytes + 12, &((const struct sockaddr_in *)from)->sin_addr, 4);
+    break;
+  case AF_INET6:
+    memcpy(addr, &((const struct sockaddr_in6 *)from)->sin6_addr, sizeof(addr));
+    break;
+  default:
+    return 1;
+  }
+
+  set    = lookup_set(addr);
+  victim = &set->ways[0];
+  for(i = 0 ; i < RATE_WAYS ; i++) {
+    e = &set->ways[i];
+
+    if(e->addr[0] == addr[0] && e->addr[1] == addr[1])
+      goto FOUND;
+
+    /* evict the source which would be full the soonest */
+    if((e->tat_packets > e->tat_bytes ? e->tat_packets : e->tat_bytes) <
+       (victim->tat_packets > victim->tat_bytes ? victim->tat_packets : victim->tat_bytes))
+      victim = e;
+  }
+
+  /* new source, its buckets are full */
+  e = victim;
+  *e = (struct rate_entry){ .addr = { addr[0], addr[1] } };
+
+FOUND:
+  if(packet_cost)
+    tat_packets = charge(e->tat_packets, packets * packet_cost, now, &allowed);
+  if(byte_cost)
+    tat_bytes   = charge(e->tat_bytes, bytes * byte_cost >> 16, now, &allowed);
+
+  if(allowed) {
+    e->tat_packets = tat_packets;
+    e->tat_bytes   = tat_bytes;
+  }
+
+  return allowed;
+}
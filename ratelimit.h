@@ -0,0 +1,73 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _RATELIMIT_H_
+#define _RATELIMIT_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Each UDP source address has a token bucket for packets and one for
+   bytes, both allowing bursts of one second worth of traffic. Sources
+   are kept in a fixed size set associative table, when a set is full
+   the source whose buckets are the closest to being full is evicted.
+   The table belongs to a single process so no locking is needed. */
+
+/* Table of the current process (NULL when disabled). */
+extern struct rate_set *rate_sets;
+
+/* Enable rate limiting per source in the current process.
+   The limits are per second, zero disables a bucket. */
+void ratelimit_init(unsigned int packets, unsigned long bytes);
+
+/* Charge packets and bytes to the source at the specified time and
+   return whether they are within its limits. Over the limit nothing
+   is charged so that the source keeps its tokens. */
+int ratelimit_check(const struct sockaddr *from, unsigned int packets, size_t bytes, uint64_t now);
+
+/* Time for the buckets, zero when disabled. A batch of
+   datagrams may be charged with the same timestamp. */
+static inline uint64_t ratelimit_clock(void)
+{
+  struct timespec ts;
+
+  if(!rate_sets)
+    return 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline int ratelimit(const struct sockaddr *from, unsigned int packets, size_t bytes, uint64_t now)
+{
+  if(!rate_sets)
+    return 1;
+
+  return ratelimit_check(from, packets, bytes, now);
+}
+
+#endif /* _RATELIMIT_H_ */
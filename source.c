@@ -0,0 +1,195 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <syslog.h>
+
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif
+#ifdef __FreeBSD__
+# include <sys/capsicum.h>
+#endif
+
+#include <gawen/safe-call.h>
+#include <gawen/common.h>
+#include <gawen/log.h>
+
+#include "echod.h"
+#include "source.h"
+
+/* The pattern repeats itself so that any offset in the first period
+   followed by the largest send or burst datagram stays in the file. */
+#define SOURCE_SIZE (SOURCE_PERIOD * (SOURCE_CHUNK / SOURCE_PERIOD + 2))
+
+static int                  pattern_fd = -1;
+static const unsigned char *pattern;
+static uint64_t             burst_pos;
+
+/* Anonymous file, removed once the last process closes it. */
+static int pattern_file(void)
+{
+  FILE *tmp;
+  int fd;
+
+#if defined(MFD_ALLOW_SEALING)
+  fd = memfd_create("echod-source", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if(fd >= 0)
+    return fd;
+#elif defined(SHM_ANON)
+  fd = shm_open(SHM_ANON, O_RDWR, 0600);
+  if(fd >= 0)
+    return fd;
+#endif
+
+  tmp = tmpfile();
+  if(!tmp)
+    sysstd_abort("cannot create source pattern");
+
+  fd = dup(fileno(tmp));
+  fclose(tmp);
+  if(fd < 0)
+    sysstd_abort("cannot create source pattern");
+
+  return fd;
+}
+
+void source_init(void)
+{
+  unsigned char *buf = xmalloc(SOURCE_SIZE);
+  unsigned int i, j, k = 0;
+  void *p;
+
+#ifdef __FreeBSD__
+  cap_rights_t rights;
+#endif
+
+  for(i = 0 ; k < SOURCE_SIZE ; i = (i + 1) % 95) {
+    for(j = 0 ; j < SOURCE_LINE ; j++)
+      buf[k++] = ' ' + (i + j) % 95;
+    buf[k++] = '\r';
+    buf[k++] = '\n';
+  }
+
+  pattern_fd = pattern_file();
+  if(write(pattern_fd, buf, SOURCE_SIZE) != SOURCE_SIZE)
+    sysstd_abort("cannot write source pattern");
+  free(buf);
+
+  /* nobody changes the pattern once the listeners run */
+#ifdef F_ADD_SEALS
+  fcntl(pattern_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+
+  p = mmap(NULL, SOURCE_SIZE, PROT_READ, MAP_SHARED, pattern_fd, 0);
+  if(p == MAP_FAILED)
+    sysstd_abort("cannot map source pattern");
+  pattern = p;
+
+#ifdef __FreeBSD__
+  cap_rights_init(&rights, CAP_PREAD, CAP_MMAP_R, CAP_FSTAT);
+  xcap_rights_limit(pattern_fd, &rights);
+#endif
+}
+
+ssize_t source_send(int fd, uint64_t *pos, size_t len)
+{
+  off_t off = *pos % SOURCE_PERIOD;
+  ssize_t n;
+
+  if(len > SOURCE_CHUNK)
+    len = SOURCE_CHUNK;
+
+#if defined(__linux__)
+  n = sendfile(fd, pattern_fd, &off, len);
+#elif defined(__FreeBSD__)
+  {
+    off_t sent = 0;
+    n = sendfile(pattern_fd, fd, off, len, NULL, &sent, 0);
+    if(n == 0 || sent > 0)
+      n = sent;
+  }
+#else
+  n = send(fd, pattern + off, len, 0);
+#endif
+
+  if(n > 0)
+    *pos += n;
+  return n;
+}
+
+int source_burst(int sd, const struct sockaddr *to, socklen_t to_len,
+                 size_t size, unsigned int count)
+{
+#ifdef MSG_WAITFORONE
+  struct mmsghdr msgs[MAX_BATCH];
+  struct iovec   iovs[MAX_BATCH];
+  unsigned int i;
+  int n;
+
+  if(count > MAX_BATCH)
+    count = MAX_BATCH;
+
+  for(i = 0 ; i < count ; i++) {
+    iovs[i] = (struct iovec){ .iov_base = (void *)(pattern + burst_pos % SOURCE_PERIOD),
+                              .iov_len  = size };
+    msgs[i] = (struct mmsghdr){ .msg_hdr = { .msg_name    = (void *)to,
+                                             .msg_namelen = to_len,
+                                             .msg_iov     = &iovs[i],
+                                             .msg_iovlen  = 1 } };
+    burst_pos += size;
+  }
+
+  for(i = 0 ; i < count ;) {
+    n = sendmmsg(sd, msgs + i, count - i, 0);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      return i ? (int)i : -1;
+    }
+    i += n;
+  }
+
+  return count;
+#else
+  unsigned int i;
+
+  for(i = 0 ; i < count ; i++) {
+    if(sendto(sd, pattern + burst_pos % SOURCE_PERIOD, size, 0, to, to_len) < 0)
+      return i ? (int)i : -1;
+    burst_pos += size;
+  }
+
+  return count;
+#endif
+}
@@ -0,0 +1,62 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SOURCE_H_
+#define _SOURCE_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdint.h>
+
+/* The source sends data instead of answering: a TCP client receives data
+   until it closes the connection and each UDP datagram is answered with
+   a burst of datagrams. The data is the character generator pattern
+   (RFC 864) in memory shared by all the processes. TCP sends it straight
+   from this memory with sendfile() and UDP bursts point into it, so the
+   data is never copied in user space. */
+
+/* Lines of 72 characters, each one starts one character further
+   among the 95 printable ASCII characters. */
+#define SOURCE_LINE   72
+#define SOURCE_PERIOD (95 * (SOURCE_LINE + 2))
+
+/* Largest single send on TCP. */
+#define SOURCE_CHUNK (1 << 20)
+
+/* Size of the datagrams answered to an empty one. */
+#define SOURCE_DATAGRAM 512
+
+/* Generate the pattern, before the listeners are forked. */
+void source_init(void);
+
+/* Send up to len bytes of the pattern on a TCP socket, continuing from
+   pos which is updated. Return the number of bytes sent or -1 on error. */
+ssize_t source_send(int fd, uint64_t *pos, size_t len);
+
+/* Send count datagrams of size bytes (at most 65507) to a peer.
+   Return the number of datagrams sent or -1 on error. */
+int source_burst(int sd, const struct sockaddr *to, socklen_t to_len,
+                 size_t size, unsigned int count);
+
+#endif /* _SOURCE_H_ */
@@ -0,0 +1,108 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <gawen/safe-call.h>
+#include <gawen/log.h>
+
+#include "stats.h"
+
+#define STATS_SIZE (sizeof(struct stats_header) + \
+                    STATS_MAX_LISTENERS * sizeof(struct stats_listener))
+
+struct stats_listener *stats;
+int stats_timing;
+
+static struct stats_header *header;
+
+void stats_open(const char *path, unsigned int flags)
+{
+  size_t len = strlen(path);
+  char *tmp = xmalloc(len + sizeof(".XXXXXX"));
+  int fd;
+
+  /* A previous daemon may still be draining with the file mapped.
+     The new file replaces it once ready, the old one goes away with
+     the last mapping instead of being truncated under it. */
+  memcpy(tmp, path, len);
+  memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+  fd = mkstemp(tmp);
+  if(fd < 0)
+    sysstd_abort("cannot create statistics file");
+
+  if(fchmod(fd, 0644) < 0)
+    sysstd_abort("cannot set statistics file mode");
+
+  if(ftruncate(fd, STATS_SIZE) < 0)
+    sysstd_abort("cannot resize statistics file");
+
+  header = mmap(NULL, STATS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(header == MAP_FAILED)
+    sysstd_abort("cannot map statistics file");
+  close(fd);
+
+  *header = (struct stats_header){ .magic         = STATS_MAGIC,
+                                   .version       = STATS_VERSION,
+                                   .max_listeners = STATS_MAX_LISTENERS,
+                                   .pid           = getpid(),
+                                   .start         = time(NULL),
+                                   .flags         = flags };
+
+  if(rename(tmp, path) < 0)
+    sysstd_abort("cannot replace statistics file");
+  free(tmp);
+}
+
+void stats_attach(unsigned int slot, const char *name, unsigned int worker)
+{
+  struct stats_listener *l;
+
+  if(!header)
+    return;
+
+  if(slot >= STATS_MAX_LISTENERS) {
+    sysstd_log(LOG_WARNING, "no statistics for %s: too many listeners", name);
+    return;
+  }
+
+  l = (struct stats_listener *)(header + 1) + slot;
+  memset(l, 0, sizeof(struct stats_listener));
+  strncpy(l->name, name, sizeof(l->name) - 1);
+  l->worker = worker;
+  l->pid    = getpid();
+
+  stats        = l;
+  stats_timing = header->flags & STATS_LATENCY;
+}
@@ -0,0 +1,180 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/* Live statistics are kept in a file mapped by all the processes.
+   The layout is shared with echod-stat which reads the file without
+   any interaction with the daemon. Each listener has its own slot. */
+
+#define STATS_MAGIC   0x65636873 /* "echs" */
+#define STATS_VERSION 2
+
+#define STATS_LATENCY 0x1 /* latency histograms enabled */
+
+#define STATS_MAX_LISTENERS 256
+#define STATS_MAX_COUNTERS  16
+
+enum stat_counter {
+  STAT_RX_PACKETS,  /* datagrams or TCP requests received */
+  STAT_RX_BYTES,
+  STAT_TX_PACKETS,  /* answers sent */
+  STAT_TX_BYTES,
+  STAT_ACCEPTED,    /* TCP connections accepted */
+  STAT_DROPPED,     /* TCP connections dropped (maximum number of clients) */
+  STAT_TIMEOUTS,    /* TCP connections timed out */
+  STAT_TRUNCATED,   /* UDP datagrams larger than the buffer */
+  STAT_RX_ERRORS,
+  STAT_TX_ERRORS,
+  STAT_COALESCED,   /* UDP datagrams received coalesced by GRO */
+  STAT_REAPED,      /* children reaped by the fork engine */
+  STAT_LIMITED,     /* UDP datagrams over the limit of their source */
+  STAT_MAX
+};
+
+/* Latency histograms in ns with log-scaled buckets as in HDR histograms.
+   Each power of two is split in sub-buckets, the error stays under 12.5%. */
+#define HIST_SUB_BITS 3
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP  40 /* up to 2^40 ns (about 18 minutes) */
+#define HIST_BUCKETS  ((HIST_MAX_EXP - HIST_SUB_BITS + 1) * HIST_SUB)
+
+enum stat_hist {
+  HIST_ACCEPT, /* TCP connection accepted to first request received */
+  HIST_REPLY,  /* request received to answer sent */
+  HIST_MAX
+};
+
+struct stats_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t max_listeners;
+  uint32_t pid;           /* main process */
+  uint64_t start;         /* UNIX time */
+  uint32_t flags;
+  char     reserved[36];
+};
+
+/* Slots are cache line aligned, the counters start on their own line. */
+struct stats_listener {
+  char     name[64];      /* address/port.protocol */
+  uint32_t pid;           /* zero when the slot is unused */
+  uint32_t worker;
+  char     reserved[56];
+
+  uint64_t counters[STATS_MAX_COUNTERS];
+  uint64_t hist[HIST_MAX][HIST_BUCKETS];
+};
+
+/* Slot of the current listener (NULL when disabled). */
+extern struct stats_listener *stats;
+
+/* Latency histograms enabled for the current listener. */
+extern int stats_timing;
+
+/* Counters are updated without any lock or system call. The slot is
+   shared by the children of a listener so updates must be atomic. */
+#define stat_add(counter, n) do {                                       \
+    if(stats)                                                           \
+      __atomic_fetch_add(&stats->counters[counter], (n), __ATOMIC_RELAXED); \
+  } while(0)
+#define stat_inc(counter) stat_add(counter, 1)
+
+static inline unsigned int hist_bucket(uint64_t v)
+{
+  unsigned int e;
+
+  if(v < HIST_SUB)
+    return v;
+
+  e = 63 - __builtin_clzll(v);
+  if(e >= HIST_MAX_EXP)
+    return HIST_BUCKETS - 1;
+
+  return (e - HIST_SUB_BITS + 1) * HIST_SUB + ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Smallest value in a bucket. */
+static inline uint64_t hist_lower(unsigned int i)
+{
+  unsigned int e;
+
+  if(i < HIST_SUB)
+    return i;
+
+  e = i / HIST_SUB + HIST_SUB_BITS - 1;
+
+  return (uint64_t)(HIST_SUB + i % HIST_SUB) << (e - HIST_SUB_BITS);
+}
+
+/* Largest value in a bucket. */
+static inline uint64_t hist_upper(unsigned int i)
+{
+  return i < HIST_BUCKETS - 1 ? hist_lower(i + 1) - 1 : hist_lower(i);
+}
+
+/* Timestamp for the latency histograms, zero when they are disabled. */
+static inline uint64_t stat_clock(void)
+{
+  struct timespec ts;
+
+  if(!stats_timing)
+    return 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Record n samples of the time elapsed since start. Listeners beyond
+   the slots of the file have no statistics, like for the counters. */
+static inline void stat_record_n(enum stat_hist hist, uint64_t start, unsigned int n)
+{
+  if(start && stats)
+    __atomic_fetch_add(&stats->hist[hist][hist_bucket(stat_clock() - start)], n, __ATOMIC_RELAXED);
+}
+#define stat_record(hist, start) stat_record_n(hist, start, 1)
+
+/* Timestamp of a request received on a connection. The first one also
+   records the time elapsed since the connection was accepted. */
+static inline uint64_t stat_request(uint64_t *accepted)
+{
+  stat_record(HIST_ACCEPT, *accepted);
+  *accepted = 0;
+
+  return stat_clock();
+}
+
+/* Create the statistics file and map it.
+   This must be called before the listeners are forked. */
+void stats_open(const char *path, unsigned int flags);
+
+/* Use the specified slot for the calling listener. */
+void stats_attach(unsigned int slot, const char *name, unsigned int worker);
+
+#endif /* _STATS_H_ */
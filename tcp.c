@@ -0,0 +1,84 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <syslog.h>
+
+#include <gawen/common.h>
+#include <gawen/log.h>
+
+#include "tcp.h"
+
+void tcp_listen_options(int sd, const struct srv_config *config)
+{
+#ifdef SO_ACCEPTFILTER
+  struct accept_filter_arg filter = { .af_name = "dataready" };
+#endif
+  int optval;
+
+#ifdef TCP_FASTOPEN
+  /* data in the SYN is delivered along with the connection */
+  if(config->fastopen) {
+    optval = config->fastopen;
+    if(setsockopt(sd, IPPROTO_TCP, TCP_FASTOPEN, &optval, sizeof(optval)) < 0)
+      sysstd_abort("cannot enable TCP Fast Open");
+  }
+#endif
+
+  /* Only accept the connections once the request has arrived.
+     FreeBSD uses an accept filter which has no timeout. */
+  if(config->defer_accept) {
+#if defined(TCP_DEFER_ACCEPT)
+    optval = config->defer_accept;
+    if(setsockopt(sd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &optval, sizeof(optval)) < 0)
+      sysstd_abort("cannot defer accept");
+#elif defined(SO_ACCEPTFILTER)
+    if(setsockopt(sd, SOL_SOCKET, SO_ACCEPTFILTER, &filter, sizeof(filter)) < 0)
+      sysstd_abort("cannot set accept filter (is accf_data loaded?)");
+#endif
+  }
+
+  /* accepted sockets inherit this option */
+  if(config->flags & SRV_NODELAY) {
+    optval = 1;
+    if(setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) < 0)
+      sysstd_abort("cannot disable Nagle algorithm");
+  }
+}
+
+void tcp_quickack(int fd, const struct srv_config *config)
+{
+#ifdef TCP_QUICKACK
+  int optval = 1;
+
+  if(config->flags & SRV_QUICKACK)
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &optval, sizeof(optval));
+#else
+  UNUSED(fd);
+  UNUSED(config);
+#endif
+}
@@ -0,0 +1,186 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/timex.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#ifdef __linux__
+# include <linux/net_tstamp.h>
+#endif
+
+#include <gawen/common.h>
+#include <gawen/log.h>
+
+#include "twamp.h"
+
+/* Offset of the fields of the answer. */
+enum twamp_field {
+  TW_SEQ           = 0,
+  TW_TIMESTAMP     = 4,
+  TW_ERROR         = 12,
+  TW_RECEIVED      = 16,
+  TW_SENDER_SEQ    = 24,
+  TW_SENDER_TIME   = 28,
+  TW_SENDER_ERROR  = 36,
+  TW_SENDER_TTL    = 40
+};
+
+/* NTP timestamps count from 1900. */
+#define NTP_EPOCH_OFFSET 2208988800UL
+
+static uint16_t error_estimate;
+
+static uint64_t ntp_time(const struct timespec *ts)
+{
+  return ((uint64_t)(ts->tv_sec + NTP_EPOCH_OFFSET) << 32) |
+         (((uint64_t)ts->tv_nsec << 32) / 1000000000);
+}
+
+static void put64(unsigned char *p, uint64_t v)
+{
+  uint32_t hi = htonl(v >> 32), lo = htonl(v & 0xffffffff);
+
+  memcpy(p, &hi, sizeof(hi));
+  memcpy(p + 4, &lo, sizeof(lo));
+}
+
+/* The error estimate tells whether the clock is synchronized and its
+   estimated error, that is multiplier * 2^(scale - 32) seconds. */
+static void init_error_estimate(void)
+{
+  struct timex tx = { .modes = 0 };
+  uint64_t error;
+  unsigned int scale = 0;
+  int synced;
+
+  synced = ntp_adjtime(&tx) >= 0 && !(tx.status & STA_UNSYNC);
+
+  /* esterror is in us */
+  error = ((uint64_t)(tx.esterror > 0 ? tx.esterror : 1) << 32) / 1000000;
+  while(error > 0xff && scale < 63) {
+    error >>= 1;
+    scale++;
+  }
+
+  error_estimate = (synced ? 0x8000 : 0) | scale << 8 | (error ? error : 1);
+}
+
+void twamp_socket(int sd, int af)
+{
+  int optval = 1;
+  int n;
+
+#if defined(SO_TIMESTAMPING)
+  int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+  n = setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+#else
+  n = setsockopt(sd, SOL_SOCKET, SO_TIMESTAMP, &optval, sizeof(optval));
+#endif
+  if(n < 0)
+    sysstd_abort("cannot enable receive timestamps");
+
+  if(af == AF_INET6)
+    n = setsockopt(sd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &optval, sizeof(optval));
+  else
+    n = setsockopt(sd, IPPROTO_IP, IP_RECVTTL, &optval, sizeof(optval));
+  if(n < 0)
+    sysstd_abort("cannot receive TTL");
+
+  init_error_estimate();
+}
+
+size_t twamp_reflect(unsigned char *buf, size_t len, size_t size, struct msghdr *msg)
+{
+  unsigned char sender[TWAMP_SENDER_SIZE];
+  struct cmsghdr *cmsg;
+  struct timespec received = { 0, 0 };
+  uint16_t mbz = 0, error = htons(error_estimate);
+  int ttl = 255;
+
+  if(len < TWAMP_SENDER_SIZE || size < TWAMP_REFLECTOR_SIZE)
+    return 0;
+
+  for(cmsg = CMSG_FIRSTHDR(msg) ; cmsg ; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if(cmsg->cmsg_level == SOL_SOCKET) {
+#if defined(SO_TIMESTAMPING)
+      if(cmsg->cmsg_type == SCM_TIMESTAMPING)
+        memcpy(&received, CMSG_DATA(cmsg), sizeof(received)); /* software */
+#else
+      if(cmsg->cmsg_type == SCM_TIMESTAMP) {
+        struct timeval tv;
+        memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+        received = (struct timespec){ tv.tv_sec, tv.tv_usec * 1000 };
+      }
+#endif
+    }
+    else if((cmsg->cmsg_level == IPPROTO_IP   && cmsg->cmsg_type == IP_TTL) ||
+            (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_HOPLIMIT))
+      memcpy(&ttl, CMSG_DATA(cmsg), sizeof(ttl));
+#ifdef IP_RECVTTL
+    else if(cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVTTL)
+      ttl = *(unsigned char *)CMSG_DATA(cmsg); /* BSD */
+#endif
+  }
+
+  /* without a timestamp from the kernel */
+  if(!received.tv_sec)
+    clock_gettime(CLOCK_REALTIME, &received);
+
+  /* the answer keeps the size and the padding of the test packet */
+  memcpy(sender, buf, sizeof(sender));
+  if(len < TWAMP_REFLECTOR_SIZE) {
+    memset(buf + len, 0, TWAMP_REFLECTOR_SIZE - len);
+    len = TWAMP_REFLECTOR_SIZE;
+  }
+
+  memcpy(buf + TW_SEQ, sender, 4);
+  memcpy(buf + TW_ERROR, &error, 2);
+  memcpy(buf + TW_ERROR + 2, &mbz, 2);
+  put64(buf + TW_RECEIVED, ntp_time(&received));
+  memcpy(buf + TW_SENDER_SEQ, sender, sizeof(sender));
+  memcpy(buf + TW_SENDER_ERROR + 2, &mbz, 2);
+  buf[TW_SENDER_TTL] = ttl;
+
+  return len;
+}
+
+uint64_t twamp_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  return ntp_time(&ts);
+}
+
+void twamp_transmit(unsigned char *buf, uint64_t now)
+{
+  put64(buf + TW_TIMESTAMP, now);
+}
@@ -0,0 +1,65 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TWAMP_H_
+#define _TWAMP_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <time.h>
+
+/* The reflector answers TWAMP-light test packets (RFC 5357, unauthenticated
+   mode) with the time each one was received, as stamped by the kernel, and
+   the time its answer is sent. The sender can subtract the time spent in
+   the reflector from the round trip and, with synchronized clocks, tell the
+   forward delay from the reverse one. The reflector keeps no session state
+   and copies the sequence number of the sender (RFC 8762, stateless mode). */
+
+/* Smallest sender packet: sequence number, timestamp and error estimate. */
+#define TWAMP_SENDER_SIZE    14
+/* Smallest answer, the padding of the sender is kept after it. */
+#define TWAMP_REFLECTOR_SIZE 41
+
+/* Room for the receive timestamp and the TTL of a test packet. */
+union twamp_control {
+  char buf[CMSG_SPACE(3 * sizeof(struct timespec)) + CMSG_SPACE(sizeof(int))];
+  struct cmsghdr align;
+};
+
+/* Stamp the datagrams received on sd and report their TTL. */
+void twamp_socket(int sd, int af);
+
+/* Turn the test packet of len bytes in buf into its answer. The buffer
+   is size bytes long. Return the size of the answer, zero when this is
+   not a test packet. The transmit time is stamped separately. */
+size_t twamp_reflect(unsigned char *buf, size_t len, size_t size, struct msghdr *msg);
+
+/* Time to stamp on the answers about to be sent (NTP format). */
+uint64_t twamp_now(void);
+
+/* Stamp the transmit time of an answer. */
+void twamp_transmit(unsigned char *buf, uint64_t now);
+
+#endif /* _TWAMP_H_ */
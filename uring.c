@@ -0,0 +1,958 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <assert.h>
+
+#include <gawen/common.h>
+#include <gawen/log.h>
+
+#include "uring.h"
+#include "buffer.h"
+#include "stats.h"
+#include "busy.h"
+#include "tcp.h"
+#include "ratelimit.h"
+#include "handoff.h"
+#include "evlog.h"
+
+#ifdef USE_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <gawen/safe-call.h>
+
+#define RING_ENTRIES 1024 /* submission queue */
+#define RING_BUFFERS 1024 /* provided buffers (power of two) */
+#define BUFFER_GROUP 0
+
+/* Operation and its target are encoded in the user data of each request. */
+enum op {
+  OP_ACCEPT,
+  OP_RECV,
+  OP_SEND,
+  OP_CANCEL
+};
+
+#define USER_DATA(op, fd, bid) ((uint64_t)(op) << 48 | (uint64_t)(bid) << 32 | (uint32_t)(fd))
+#define USER_OP(data)          ((enum op)((data) >> 48))
+#define USER_BID(data)         ((unsigned int)((data) >> 32) & 0xffff)
+#define USER_FD(data)          ((int)((data) & 0xffffffff))
+
+#define load_acquire(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static struct {
+  int fd;
+
+  /* submission queue */
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int  sq_mask;
+  unsigned int  sq_entries;
+  unsigned int  sq_local; /* tail not yet published */
+  unsigned int  to_submit;
+  struct io_uring_sqe *sqes;
+
+  /* completion queue */
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int  cq_mask;
+  struct io_uring_cqe *cqes;
+
+  /* provided buffers */
+  struct io_uring_buf_ring *br;
+  unsigned short br_tail;
+  unsigned char *buffers;
+  size_t         buffer_size;
+} ring;
+
+static void ring_init(void)
+{
+  struct io_uring_params p;
+  unsigned int *array, i;
+  size_t len;
+  void *sq;
+
+  memset(&p, 0, sizeof(p));
+  p.flags      = IORING_SETUP_CQSIZE;
+  p.cq_entries = RING_ENTRIES * 4; /* multishot requests complete many times */
+
+  ring.fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+  if(ring.fd < 0)
+    sysstd_abort("cannot setup io_uring");
+
+  /* waiting with a timeout needs 5.11 and implies a single mmap */
+  if(!(p.features & IORING_FEAT_EXT_ARG))
+    sysstd_abortx("io_uring not supported by this kernel");
+
+  len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  if(len < p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe))
+    len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  sq = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+  if(sq == MAP_FAILED)
+    sysstd_abort("cannot map io_uring");
+
+  ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+  if(ring.sqes == MAP_FAILED)
+    sysstd_abort("cannot map io_uring");
+
+  ring.sq_head    = (unsigned int *)((char *)sq + p.sq_off.head);
+  ring.sq_tail    = (unsigned int *)((char *)sq + p.sq_off.tail);
+  ring.sq_mask    = *(unsigned int *)((char *)sq + p.sq_off.ring_mask);
+  ring.sq_entries = p.sq_entries;
+  ring.sq_local   = *ring.sq_tail;
+  ring.cq_head    = (unsigned int *)((char *)sq + p.cq_off.head);
+  ring.cq_tail    = (unsigned int *)((char *)sq + p.cq_off.tail);
+  ring.cq_mask    = *(unsigned int *)((char *)sq + p.cq_off.ring_mask);
+  ring.cqes       = (struct io_uring_cqe *)((char *)sq + p.cq_off.cqes);
+
+  /* each submission entry always stays at the same index */
+  array = (unsigned int *)((char *)sq + p.sq_off.array);
+  for(i = 0 ; i < p.sq_entries ; i++)
+    array[i] = i;
+}
+
+/* draining as the server loop last saw it */
+static int drain_seen;
+
+/* Submit the queued requests and wait for at most wait_ms
+   (-1 for no limit) until at least one request completes.
+   The signal mask while waiting may be NULL to keep ours. */
+static void ring_enter(unsigned int wait_nr, int wait_ms, const sigset_t *mask)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  unsigned int flags = 0;
+  int n;
+
+  memset(&arg, 0, sizeof(arg));
+  if(wait_ms >= 0) {
+    ts = (struct __kernel_timespec){ .tv_sec  = wait_ms / 1000,
+                                     .tv_nsec = (wait_ms % 1000) * 1000000 };
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+  }
+  if(mask) {
+    arg.sigmask    = (uint64_t)(uintptr_t)mask;
+    arg.sigmask_sz = _NSIG / 8;
+  }
+  if(wait_nr)
+    flags = IORING_ENTER_GETEVENTS;
+
+  store_release(ring.sq_tail, ring.sq_local);
+
+  n = syscall(__NR_io_uring_enter, ring.fd, ring.to_submit, wait_nr,
+              flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  if(n < 0) {
+    switch(errno) {
+    case EINTR:
+    case ETIME:
+    case EBUSY: /* completion queue full */
+      return;
+    default:
+      sysstd_abort("io_uring error");
+    }
+  }
+
+  ring.to_submit -= n;
+}
+
+/* Spin on the completion queue for the busy poll budget, entering the
+   kernel only to submit and run the pending work, then wait as usual. */
+static void ring_wait(int wait_ms)
+{
+  const sigset_t *mask;
+
+  if(busy_budget) {
+    uint64_t deadline = busy_deadline();
+
+    do {
+      ring_enter(0, -1, NULL);
+      if(*ring.cq_head != load_acquire(ring.cq_tail))
+        return;
+    } while(busy_spinning(deadline));
+  }
+
+  /* nothing to wait for */
+  if(*ring.cq_head != load_acquire(ring.cq_tail)) {
+    ring_enter(0, -1, NULL);
+    return;
+  }
+
+  /* a drain not seen by the loop is handled before we sleep */
+  mask = drain_block();
+  if(draining == drain_seen)
+    ring_enter(1, wait_ms, mask);
+  else
+    ring_enter(0, -1, NULL);
+  drain_unblock();
+}
+
+static struct io_uring_sqe * get_sqe(void)
+{
+  struct io_uring_sqe *sqe;
+
+  /* submission queue full */
+  while(ring.sq_local - load_acquire(ring.sq_head) >= ring.sq_entries)
+    ring_enter(0, -1, NULL);
+
+  sqe = &ring.sqes[ring.sq_local & ring.sq_mask];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+  ring.sq_local++;
+  ring.to_submit++;
+
+  return sqe;
+}
+
+static void buffers_init(size_t size, int huge_pages)
+{
+  struct io_uring_buf_reg reg;
+  unsigned int i;
+
+  ring.br = mmap(NULL, RING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(ring.br == MAP_FAILED)
+    sysstd_abort("cannot allocate buffer ring");
+
+  ring.buffer_size = size;
+  ring.buffers     = alloc_buffers(size, RING_BUFFERS, huge_pages);
+
+  memset(&reg, 0, sizeof(reg));
+  reg = (struct io_uring_buf_reg){ .ring_addr    = (uint64_t)(uintptr_t)ring.br,
+                                   .ring_entries = RING_BUFFERS,
+                                   .bgid         = BUFFER_GROUP };
+  if(syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    sysstd_abort("cannot register buffer ring");
+
+  for(i = 0 ; i < RING_BUFFERS ; i++) {
+    struct io_uring_buf *b = &ring.br->bufs[i];
+
+    b->addr = (uint64_t)(uintptr_t)(ring.buffers + i * size);
+    b->len  = size;
+    b->bid  = i;
+  }
+  ring.br_tail = RING_BUFFERS;
+  store_release(&ring.br->tail, ring.br_tail);
+}
+
+/* when the request in each buffer was received */
+static uint64_t buffer_received[RING_BUFFERS];
+
+static unsigned char * buffer_get(unsigned int bid)
+{
+  return ring.buffers + bid * ring.buffer_size;
+}
+
+/* Give a buffer back to the kernel. */
+static void buffer_recycle(unsigned int bid)
+{
+  struct io_uring_buf *b = &ring.br->bufs[ring.br_tail & (RING_BUFFERS - 1)];
+
+#ifdef DO_CLEAR_BUFFER
+  memset(buffer_get(bid), 0, ring.buffer_size);
+#endif
+
+  b->addr = (uint64_t)(uintptr_t)buffer_get(bid);
+  b->len  = ring.buffer_size;
+  b->bid  = bid;
+
+  ring.br_tail++;
+  store_release(&ring.br->tail, ring.br_tail);
+}
+
+/* Call handle on each completion and return once
+   the completion queue is empty. */
+static void reap(void (*handle)(const struct io_uring_cqe *))
+{
+  unsigned int head = *ring.cq_head;
+
+  while(head != load_acquire(ring.cq_tail)) {
+    struct io_uring_cqe cqe = ring.cqes[head & ring.cq_mask];
+
+    /* release the entry before handling it so that
+       the completion queue does not overflow */
+    store_release(ring.cq_head, ++head);
+    handle(&cqe);
+  }
+}
+
+/* Cancel a request, its completion is ignored. */
+static void ring_cancel(uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = get_sqe();
+
+  sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+  sqe->addr      = user_data;
+  sqe->user_data = USER_DATA(OP_CANCEL, 0, 0);
+}
+
+static int cqe_bid(const struct io_uring_cqe *cqe)
+{
+  if(!(cqe->flags & IORING_CQE_F_BUFFER))
+    return -1;
+  return cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+}
+
+/* ===== UDP ===== */
+
+static int    udp_sd;
+static int    udp_starved;   /* no buffer left to receive */
+static int    udp_receiving; /* multishot receive armed */
+static unsigned int udp_sending; /* answers in flight */
+static size_t udp_buffer_size;
+
+/* Template for the multishot receive. The kernel writes the
+   io_uring_recvmsg_out header, the peer address and the payload
+   in each provided buffer. */
+static struct msghdr udp_recv_msg = { .msg_namelen = sizeof(struct sockaddr_storage) };
+
+#ifndef DISCARDD
+/* Answers must stay valid until they complete
+   so there is one per provided buffer. */
+static struct {
+  struct msghdr msg;
+  struct iovec  iov;
+} udp_answers[RING_BUFFERS];
+#endif
+
+static void udp_arm_recv(void)
+{
+  struct io_uring_sqe *sqe = get_sqe();
+
+  sqe->opcode    = IORING_OP_RECVMSG;
+  sqe->fd        = udp_sd;
+  sqe->addr      = (uint64_t)(uintptr_t)&udp_recv_msg;
+  sqe->len       = 1;
+  sqe->ioprio    = IORING_RECV_MULTISHOT;
+  sqe->flags     = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->user_data = USER_DATA(OP_RECV, udp_sd, 0);
+
+  udp_receiving = 1;
+}
+
+static void udp_release(unsigned int bid)
+{
+  buffer_recycle(bid);
+
+  if(udp_starved && !draining) {
+    udp_starved = 0;
+    udp_arm_recv();
+  }
+}
+
+static void udp_recv(const struct io_uring_cqe *cqe)
+{
+  int bid = cqe_bid(cqe);
+
+  if(cqe->res < 0) {
+    switch(-cqe->res) {
+    case ENOBUFS:
+      /* wait until an answer completes */
+      udp_starved   = 1;
+      udp_receiving = 0;
+      return;
+    case EINTR:
+    case ECANCELED:
+      break;
+    default:
+      errno = -cqe->res;
+      sysstd_abort("receive error");
+    }
+  }
+  else if(bid >= 0) {
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buffer_get(bid);
+#ifndef DISCARDD
+    struct io_uring_sqe *sqe;
+#endif
+
+    buffer_received[bid] = stat_clock();
+
+    stat_inc(STAT_RX_PACKETS);
+    stat_add(STAT_RX_BYTES, out->payloadlen);
+
+    /* Truncated datagrams are not answered, a partial echo
+       would look like a valid answer to the client. */
+    if(out->flags & MSG_TRUNC) {
+      stat_inc(STAT_TRUNCATED);
+      evlog(EV_TRUNCATED, 0);
+      udp_release(bid);
+      goto REARM;
+    }
+
+#ifndef DISCARDD
+    if(!ratelimit((struct sockaddr *)(out + 1), 1, out->payloadlen, ratelimit_clock())) {
+      stat_inc(STAT_LIMITED);
+      udp_release(bid);
+      goto REARM;
+    }
+
+    udp_answers[bid].iov = (struct iovec){
+      .iov_base = (char *)(out + 1) + udp_recv_msg.msg_namelen,
+      .iov_len  = out->payloadlen };
+    udp_answers[bid].msg = (struct msghdr){
+      .msg_name    = out + 1,
+      .msg_namelen = out->namelen,
+      .msg_iov     = &udp_answers[bid].iov,
+      .msg_iovlen  = 1 };
+
+    /* answer */
+    sqe = get_sqe();
+    sqe->opcode    = IORING_OP_SENDMSG;
+    sqe->fd        = udp_sd;
+    sqe->addr      = (uint64_t)(uintptr_t)&udp_answers[bid].msg;
+    sqe->len       = 1;
+    sqe->user_data = USER_DATA(OP_SEND, udp_sd, bid);
+    udp_sending++;
+#else
+    buffer_recycle(bid);
+#endif
+  }
+
+REARM:
+  /* the multishot request may stop at any time */
+  if(!(cqe->flags & IORING_CQE_F_MORE)) {
+    udp_receiving = 0;
+    if(!draining)
+      udp_arm_recv();
+  }
+}
+
+static void udp_handle(const struct io_uring_cqe *cqe)
+{
+  switch(USER_OP(cqe->user_data)) {
+  case OP_RECV:
+    udp_recv(cqe);
+    break;
+  case OP_SEND:
+    if(cqe->res < 0) {
+      errno = -cqe->res;
+      sysstd_abort("send error");
+    }
+    stat_inc(STAT_TX_PACKETS);
+    stat_add(STAT_TX_BYTES, cqe->res);
+    stat_record(HIST_REPLY, buffer_received[USER_BID(cqe->user_data)]);
+    udp_release(USER_BID(cqe->user_data));
+    udp_sending--;
+    break;
+  case OP_CANCEL:
+    break;
+  default:
+    assert(0);
+  }
+}
+
+void server_udp_uring(int sd, const struct srv_config *config)
+{
+  int cancelled = 0;
+
+  udp_sd          = sd;
+  udp_buffer_size = config->buffer_size;
+
+  ring_init();
+  buffers_init(sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage) + config->buffer_size,
+               config->flags & SRV_HUGE_PAGES);
+
+  udp_arm_recv();
+
+  while(1) {
+    /* stop receiving and wait for the answers in flight */
+    drain_seen = draining;
+    if(drain_seen) {
+      if(udp_receiving && !cancelled) {
+        ring_cancel(USER_DATA(OP_RECV, udp_sd, 0));
+        cancelled = 1;
+      }
+      if(!udp_receiving && !udp_sending)
+        drain_exit();
+    }
+
+    ring_wait(-1);
+    reap(udp_handle);
+  }
+}
+
+/* ===== TCP ===== */
+
+/* Connections are linked by descriptor in two lists. All connections
+   share the same timeout so they are queued in the timeout list in the
+   order of their last activity, which is also the order of their
+   deadline. Connections which ran out of buffers wait in the starved
+   list until a buffer is released. */
+enum list_id {
+  LIST_TIMEOUT,
+  LIST_STARVED,
+  LIST_MAX
+};
+
+struct link {
+  int prev;
+  int next;
+};
+
+/* Each connection is indexed by its descriptor. Received buffers
+   are queued and sent one at a time to keep the stream in order. */
+struct uconn {
+  int active;
+  int reading;  /* multishot receive pending */
+  int closing;  /* do not answer anymore */
+  int timed;    /* in the timeout list */
+  int starved;  /* in the starved list */
+
+  /* buffers waiting to be sent, the first one is in flight */
+  int    queue_head;
+  int    queue_tail;
+  size_t off;
+
+  uint64_t deadline; /* ms */
+  uint64_t accepted; /* latency timestamp */
+
+  struct link links[LIST_MAX];
+};
+
+static const struct srv_config *tcp_config;
+static int tcp_sd;
+
+static struct uconn *conns;
+static int           conns_size;
+static unsigned int  clients;
+
+static struct {
+  int head;
+  int tail;
+} lists[LIST_MAX] = { { -1, -1 }, { -1, -1 } };
+
+/* next queued buffer and its length */
+static int    buffer_next[RING_BUFFERS];
+static size_t buffer_len[RING_BUFFERS];
+
+static uint64_t now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void list_push(enum list_id id, int fd)
+{
+  conns[fd].links[id] = (struct link){ .prev = lists[id].tail, .next = -1 };
+
+  if(lists[id].tail >= 0)
+    conns[lists[id].tail].links[id].next = fd;
+  else
+    lists[id].head = fd;
+  lists[id].tail = fd;
+}
+
+static void list_remove(enum list_id id, int fd)
+{
+  struct link *l = &conns[fd].links[id];
+
+  if(l->prev >= 0)
+    conns[l->prev].links[id].next = l->next;
+  else
+    lists[id].head = l->next;
+
+  if(l->next >= 0)
+    conns[l->next].links[id].prev = l->prev;
+  else
+    lists[id].tail = l->prev;
+}
+
+static int tcp_accepting; /* multishot accept armed */
+
+static void tcp_arm_accept(void)
+{
+  struct io_uring_sqe *sqe = get_sqe();
+
+  sqe->opcode       = IORING_OP_ACCEPT;
+  sqe->fd           = tcp_sd;
+  sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data    = USER_DATA(OP_ACCEPT, tcp_sd, 0);
+
+  tcp_accepting = 1;
+}
+
+static void tcp_arm_recv(int fd)
+{
+  struct io_uring_sqe *sqe = get_sqe();
+
+  sqe->opcode    = IORING_OP_RECV;
+  sqe->fd        = fd;
+  sqe->ioprio    = IORING_RECV_MULTISHOT;
+  sqe->flags     = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->user_data = USER_DATA(OP_RECV, fd, 0);
+
+  conns[fd].reading = 1;
+}
+
+static void tcp_arm_send(int fd)
+{
+  struct io_uring_sqe *sqe = get_sqe();
+  struct uconn *c = &conns[fd];
+  int bid = c->queue_head;
+
+  sqe->opcode    = IORING_OP_SEND;
+  sqe->fd        = fd;
+  sqe->addr      = (uint64_t)(uintptr_t)(buffer_get(bid) + c->off);
+  sqe->len       = buffer_len[bid] - c->off;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = USER_DATA(OP_SEND, fd, bid);
+}
+
+static void tcp_release(unsigned int bid)
+{
+  int fd = lists[LIST_STARVED].head;
+
+  buffer_recycle(bid);
+
+  /* resume the connection that waits for a buffer the longest */
+  if(fd >= 0) {
+    list_remove(LIST_STARVED, fd);
+    conns[fd].starved = 0;
+    tcp_arm_recv(fd);
+  }
+}
+
+/* Stop answering the connection. The pending requests
+   complete and the descriptor is closed once they are done.
+   A timeout also aborts the answers (SHUT_RDWR). Until then the
+   connection stays in the timeout list so that an answer which
+   the client does not read is aborted too. */
+static void tcp_stop(int fd, int how)
+{
+  struct uconn *c = &conns[fd];
+
+  c->closing = 1;
+  if(c->timed && how == SHUT_RDWR) {
+    c->timed = 0;
+    list_remove(LIST_TIMEOUT, fd);
+  }
+  if(c->starved) {
+    c->starved = 0;
+    list_remove(LIST_STARVED, fd);
+  }
+
+  /* wake up the pending requests */
+  if(c->reading || how == SHUT_RDWR)
+    shutdown(fd, how);
+}
+
+/* Close the connection when nothing is pending anymore. */
+static void tcp_try_close(int fd)
+{
+  struct uconn *c = &conns[fd];
+
+  if(!c->closing || c->reading || c->queue_head >= 0)
+    return;
+
+  if(c->timed) {
+    c->timed = 0;
+    list_remove(LIST_TIMEOUT, fd);
+  }
+
+  close(fd);
+  c->active = 0;
+  clients--;
+}
+
+static void tcp_accept(const struct io_uring_cqe *cqe)
+{
+  int fd = cqe->res;
+
+  if(!(cqe->flags & IORING_CQE_F_MORE)) {
+    tcp_accepting = 0;
+    if(!draining)
+      tcp_arm_accept();
+  }
+
+  if(fd < 0) {
+    errno = -fd;
+    switch(errno) {
+    case EINTR:
+    case ECONNABORTED:
+    case ECANCELED:
+      return;
+    case EMFILE:
+    case ENFILE:
+      evlog(EV_ACCEPT_ERROR, errno);
+      return;
+    default:
+      sysstd_abort("accept error");
+    }
+  }
+
+  if(tcp_config->max_clients && clients >= tcp_config->max_clients) {
+    close(fd);
+    stat_inc(STAT_DROPPED);
+    evlog(EV_DROPPED, 0);
+    return;
+  }
+
+  if(fd >= conns_size) {
+    int size = conns_size ? conns_size : 64;
+
+    while(size <= fd)
+      size *= 2;
+
+    conns = realloc(conns, size * sizeof(struct uconn));
+    if(!conns)
+      sysstd_abort("cannot allocate connections");
+    memset(conns + conns_size, 0, (size - conns_size) * sizeof(struct uconn));
+    conns_size = size;
+  }
+
+  conns[fd] = (struct uconn){ .active     = 1,
+                              .timed      = 1,
+                              .queue_head = -1,
+                              .queue_tail = -1,
+                              .deadline   = now_ms() + tcp_config->timeout,
+                              .accepted   = stat_clock() };
+  list_push(LIST_TIMEOUT, fd);
+  clients++;
+  stat_inc(STAT_ACCEPTED);
+
+  tcp_quickack(fd, tcp_config);
+
+  tcp_arm_recv(fd);
+}
+
+#ifndef DISCARDD
+static void tcp_queue_answer(int fd, int bid, size_t len)
+{
+  struct uconn *c = &conns[fd];
+
+  buffer_len[bid]  = len;
+  buffer_next[bid] = -1;
+
+  if(c->queue_tail >= 0)
+    buffer_next[c->queue_tail] = bid;
+  else {
+    c->queue_head = bid;
+    c->off        = 0;
+    tcp_arm_send(fd);
+  }
+  c->queue_tail = bid;
+}
+#endif /* DISCARDD */
+
+static void tcp_recv(const struct io_uring_cqe *cqe)
+{
+  int fd  = USER_FD(cqe->user_data);
+  int bid = cqe_bid(cqe);
+  struct uconn *c = &conns[fd];
+
+  if(!(cqe->flags & IORING_CQE_F_MORE))
+    c->reading = 0;
+
+  if(bid >= 0) {
+    buffer_received[bid] = stat_request(&c->accepted);
+
+    stat_inc(STAT_RX_PACKETS);
+    stat_add(STAT_RX_BYTES, cqe->res);
+
+    if(c->closing)
+      tcp_release(bid);
+    else {
+#ifndef DISCARDD
+      tcp_queue_answer(fd, bid, cqe->res);
+#else
+      tcp_release(bid);
+#endif
+
+      if(tcp_config->flags & SRV_STREAM) {
+        tcp_quickack(fd, tcp_config);
+        list_remove(LIST_TIMEOUT, fd);
+        c->deadline = now_ms() + tcp_config->timeout;
+        list_push(LIST_TIMEOUT, fd);
+      }
+      else /* We answer a single request. */
+        tcp_stop(fd, SHUT_RD);
+    }
+  }
+  else if(cqe->res == -ENOBUFS) {
+    /* wait until a buffer is released */
+    if(!c->closing) {
+      c->starved = 1;
+      list_push(LIST_STARVED, fd);
+    }
+  }
+  else { /* end of stream or error */
+    if(cqe->res < 0 && !c->closing)
+      stat_inc(STAT_RX_ERRORS);
+    tcp_stop(fd, SHUT_RD);
+  }
+
+  /* the multishot request may stop at any time */
+  if(!c->reading && !c->starved && !c->closing)
+    tcp_arm_recv(fd);
+
+  tcp_try_close(fd);
+}
+
+static void tcp_send(const struct io_uring_cqe *cqe)
+{
+  int fd  = USER_FD(cqe->user_data);
+  int bid = USER_BID(cqe->user_data);
+  struct uconn *c = &conns[fd];
+
+  if(cqe->res < 0) {
+    stat_inc(STAT_TX_ERRORS);
+
+    /* drop all the pending answers */
+    while(c->queue_head >= 0) {
+      int next = buffer_next[c->queue_head];
+      tcp_release(c->queue_head);
+      c->queue_head = next;
+    }
+    c->queue_tail = -1;
+
+    tcp_stop(fd, SHUT_RDWR);
+    tcp_try_close(fd);
+    return;
+  }
+
+  c->off += cqe->res;
+  stat_add(STAT_TX_BYTES, cqe->res);
+  if(c->off < buffer_len[bid]) {
+    /* partial send */
+    tcp_arm_send(fd);
+    return;
+  }
+
+  /* answer sent */
+  stat_inc(STAT_TX_PACKETS);
+  stat_record(HIST_REPLY, buffer_received[bid]);
+  c->queue_head = buffer_next[bid];
+  c->off        = 0;
+  if(c->queue_head < 0)
+    c->queue_tail = -1;
+  tcp_release(bid);
+
+  if(c->queue_head >= 0)
+    tcp_arm_send(fd);
+  else
+    tcp_try_close(fd);
+}
+
+static void tcp_handle(const struct io_uring_cqe *cqe)
+{
+  switch(USER_OP(cqe->user_data)) {
+  case OP_ACCEPT:
+    tcp_accept(cqe);
+    break;
+  case OP_RECV:
+    tcp_recv(cqe);
+    break;
+  case OP_SEND:
+    tcp_send(cqe);
+    break;
+  case OP_CANCEL:
+    break;
+  default:
+    assert(0);
+  }
+}
+
+/* Abort the connections which expired and return the
+   time in ms until the next deadline (-1 if none). */
+static int expire_conns(void)
+{
+  uint64_t now;
+  int fd;
+
+  if(!tcp_config->timeout)
+    return -1;
+
+  now = now_ms();
+  while((fd = lists[LIST_TIMEOUT].head) >= 0 && conns[fd].deadline <= now) {
+    evlog(EV_TIMEOUT, 0);
+    stat_inc(STAT_TIMEOUTS);
+    tcp_stop(fd, SHUT_RDWR);
+    tcp_try_close(fd);
+  }
+
+  return fd >= 0 ? (int)(conns[fd].deadline - now) : -1;
+}
+
+void server_tcp_uring(int sd, const struct srv_config *config)
+{
+  int cancelled = 0;
+
+  tcp_config = config;
+  tcp_sd     = sd;
+
+  ring_init();
+  buffers_init(config->buffer_size, config->flags & SRV_HUGE_PAGES);
+
+  tcp_arm_accept();
+
+  while(1) {
+    /* stop accepting and serve the connections left */
+    drain_seen = draining;
+    if(drain_seen) {
+      if(tcp_accepting && !cancelled) {
+        ring_cancel(USER_DATA(OP_ACCEPT, tcp_sd, 0));
+        cancelled = 1;
+      }
+      if(!tcp_accepting && !clients)
+        drain_exit();
+    }
+
+    ring_wait(expire_conns());
+    reap(tcp_handle);
+  }
+}
+
+#else /* !USE_URING */
+
+void server_udp_uring(int sd, const struct srv_config *config)
+{
+  UNUSED(sd);
+  UNUSED(config);
+
+  sysstd_abortx("io_uring engine not supported on this platform");
+}
+
+void server_tcp_uring(int sd, const struct srv_config *config)
+{
+  server_udp_uring(sd, config);
+}
+
+#endif /* USE_URING */
@@ -0,0 +1,168 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#ifdef __linux__
+# include <linux/errqueue.h>
+#endif
+
+#include <gawen/common.h>
+
+#include "zerocopy.h"
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+
+/* The kernel numbers the zero copy sends of each socket and reports
+   ranges of completed sends. One socket is served at a time so the
+   counters are reset for each one. */
+static size_t   zc_threshold;
+static int      zc_enabled;
+static uint32_t zc_sent;
+static uint32_t zc_completed;
+
+void zerocopy_init(size_t threshold)
+{
+  zc_threshold = threshold;
+}
+
+void zerocopy_socket(int fd)
+{
+  int optval = 1;
+
+  zc_sent      = 0;
+  zc_completed = 0;
+  zc_enabled   = zc_threshold &&
+                 !setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval));
+}
+
+ssize_t zerocopy_send(int fd, const void *buf, size_t len)
+{
+  ssize_t n;
+
+  if(zc_enabled && len >= zc_threshold) {
+    n = send(fd, buf, len, MSG_ZEROCOPY);
+    if(n >= 0) {
+      zc_sent++;
+      return n;
+    }
+
+    /* out of pinned memory, copy this one */
+    if(errno != ENOBUFS)
+      return n;
+  }
+
+  return send(fd, buf, len, 0);
+}
+
+/* Read the completions on the error queue. */
+static void zerocopy_reap(int fd)
+{
+  char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+
+  while(1) {
+    msg = (struct msghdr){ .msg_control    = control,
+                           .msg_controllen = sizeof(control) };
+    if(recvmsg(fd, &msg, MSG_ERRQUEUE) < 0)
+      return;
+
+    for(cmsg = CMSG_FIRSTHDR(&msg) ; cmsg ; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      const struct sock_extended_err *ee = (const struct sock_extended_err *)CMSG_DATA(cmsg);
+
+      if(ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+
+      /* sends from ee_info to ee_data */
+      zc_completed += ee->ee_data - ee->ee_info + 1;
+
+      /* The kernel had to copy the data anyway, for example on
+         loopback. Copying right away is cheaper from now on. */
+      if(ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        zc_threshold = 0;
+    }
+  }
+}
+
+int zerocopy_wait(int fd)
+{
+  struct pollfd pfd = { .fd = fd, .events = 0 };
+  struct timespec start, now;
+  socklen_t err_len = sizeof(int);
+  int elapsed, err;
+
+  /* most answers are copied */
+  if(zc_completed == zc_sent)
+    return 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  zerocopy_reap(fd);
+  while(zc_completed != zc_sent) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+    if(elapsed >= ZEROCOPY_TIMEOUT)
+      return -1;
+
+    /* the error queue is reported as POLLERR */
+    if(poll(&pfd, 1, ZEROCOPY_TIMEOUT - elapsed) < 0 && errno != EINTR)
+      return -1;
+    zerocopy_reap(fd);
+
+    /* so is a pending socket error, clear it or we would spin */
+    if(pfd.revents & POLLERR && zc_completed != zc_sent)
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+  }
+
+  return 0;
+}
+
+#else
+void zerocopy_init(size_t threshold)
+{
+  UNUSED(threshold);
+}
+
+void zerocopy_socket(int fd)
+{
+  UNUSED(fd);
+}
+
+ssize_t zerocopy_send(int fd, const void *buf, size_t len)
+{
+  return send(fd, buf, len, 0);
+}
+
+int zerocopy_wait(int fd)
+{
+  UNUSED(fd);
+  return 0;
+}
+#endif /* MSG_ZEROCOPY */
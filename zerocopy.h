@@ -0,0 +1,55 @@
+/* Copyright (c) 2018, David Hauweele <david@hauweele.net>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _ZEROCOPY_H_
+#define _ZEROCOPY_H_
+
+#include <sys/types.h>
+#include <stddef.h>
+
+/* Large TCP answers may be sent without copying the buffer into the
+   kernel (MSG_ZEROCOPY). The kernel then references the pages of the
+   buffer until the data is acknowledged and reports when it is done
+   on the error queue of the socket. The buffer must not be written
+   until then. This is only available on Linux, elsewhere the answers
+   are always copied. */
+
+/* Time allowed to the kernel to release the buffer (ms). */
+#define ZEROCOPY_TIMEOUT 5000
+
+/* Send the answers of at least threshold bytes without copy. */
+void zerocopy_init(size_t threshold);
+
+/* Enable zero copy on an accepted socket. */
+void zerocopy_socket(int fd);
+
+/* Send an answer, without copy when it is large enough. */
+ssize_t zerocopy_send(int fd, const void *buf, size_t len);
+
+/* Wait until the kernel released the answers sent on fd. Return 0
+   once done, right away when every answer was copied or already
+   released, and -1 after ZEROCOPY_TIMEOUT. */
+int zerocopy_wait(int fd);
+
+#endif /* _ZEROCOPY_H_ */